@@ -1,17 +1,29 @@
 #pragma once
 #include "kuzco/Kuzco.hpp"
 
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 template <typename T>
-class StateRoot : private kuzco::Root<T> {
+class StateRoot : private kuzco::Root<T>, public kuzco::Publisher<T> {
 public:
-    using kuzco::Root<T>::Root;
+    template <typename... Args>
+    explicit StateRoot(Args&&... args)
+        : kuzco::Root<T>(std::forward<Args>(args)...)
+    {
+        // path subscriptions compare the first published state with the initial one
+        this->setBaseline(this->detachedPayload());
+    }
 
     struct Transaction {
     public:
         Transaction(StateRoot& r)
-            : m_ptr(r.beginTransaction())
-            , m_root(r)
-        {}
+            : m_root(r)
+        {
+            r.beginTransaction();
+        }
 
         Transaction(const Transaction&) = delete;
         Transaction& operator=(const Transaction&) = delete;
@@ -20,15 +32,22 @@ public:
 
         void cancel() { m_cancelled = true; }
 
-        T* operator->() { return m_ptr; }
-        T& operator*() { return *m_ptr; }
+        // non-const access clones the root on first use
+        // const access doesn't, so read-only transactions are free
+        const Transaction& r() const { return *this; }
+        const T* get() const { return std::as_const(m_root).transactionData(); }
+        const T* operator->() const { return get(); }
+        const T& operator*() const { return *get(); }
+
+        T* get() { return m_root.transactionData(); }
+        T* operator->() { return get(); }
+        T& operator*() { return *get(); }
 
         ~Transaction() {
             bool store = !m_cancelled && !std::uncaught_exceptions();
             m_root.endTransaction(store);
         }
     private:
-        T* m_ptr;
         StateRoot& m_root;
         bool m_cancelled = false;
     };
@@ -37,16 +56,166 @@ public:
         return Transaction(*this);
     }
 
+#if KUZCO_HAS_COROUTINES
+    // a transaction which isn't bound to a thread
+    // it can be kept across suspension points and ended on any thread
+    // unlike Transaction it's movable (a moved-from transaction ends nothing)
+    class AsyncTransaction {
+    public:
+        AsyncTransaction(AsyncTransaction&& other) noexcept
+            : m_root(std::exchange(other.m_root, nullptr))
+            , m_cancelled(other.m_cancelled)
+        {}
+        AsyncTransaction& operator=(AsyncTransaction&&) = delete;
+
+        void cancel() { m_cancelled = true; }
+
+        const AsyncTransaction& r() const { return *this; }
+        const T* get() const { return std::as_const(*m_root).transactionData(); }
+        const T* operator->() const { return get(); }
+        const T& operator*() const { return *get(); }
+
+        T* get() { return m_root->transactionData(); }
+        T* operator->() { return get(); }
+        T& operator*() { return *get(); }
+
+        ~AsyncTransaction() {
+            if (!m_root) return;
+            bool store = !m_cancelled && !std::uncaught_exceptions();
+            m_root->endTransaction(store);
+        }
+    private:
+        friend class StateRoot;
+        explicit AsyncTransaction(StateRoot& r) : m_root(&r) {}
+        StateRoot* m_root;
+        bool m_cancelled = false;
+    };
+
+    struct AsyncTransactionAwaitable {
+        typename kuzco::Root<T>::BeginAwaitable begin;
+        StateRoot& root;
+        bool await_ready() { return begin.await_ready(); }
+        bool await_suspend(std::coroutine_handle<> h) { return begin.await_suspend(h); }
+        AsyncTransaction await_resume() {
+            begin.await_resume();
+            return AsyncTransaction(root);
+        }
+    };
+
+    // auto t = co_await root.asyncTransaction(resumer);
+    // waits for the transaction lock by suspending the coroutine instead of blocking the thread
+    // waiting coroutines are resumed in FIFO order through resumer (inline if it's empty)
+    AsyncTransactionAwaitable asyncTransaction(kuzco::Resumer resumer = {}) {
+        return {this->beginTransactionAsync(std::move(resumer)), *this};
+    }
+#endif
+
+    // runs f(T&) in an optimistic transaction, which doesn't block other optimistic writers
+    // if another transaction was stored in the meantime, the changes are merged with it
+    // and f is called again on the new state only if they conflict (see Root::OptimisticTransaction)
+    // so it shouldn't have side effects outside of the state
+    // after maxConflicts failed attempts, it's executed in a regular transaction to guarantee progress
+    template <typename F>
+    void optimisticTransaction(F f, int maxConflicts = 8) {
+        typename kuzco::Root<T>::OptimisticTransaction ot(*this);
+        for (int i = 0; i < maxConflicts; ++i) {
+            f(*ot);
+            if (ot.commit()) {
+                notifySubscribers();
+                return;
+            }
+            ot.restart();
+        }
+        auto t = transaction();
+        f(*t);
+    }
+
+    // flat combining transaction
+    // f(T&) is queued and whichever thread gets the transaction lock applies all queued mutations
+    // in a single transaction: one root clone and one publish for the entire batch
+    // returns after f has been applied and published, rethrows if f has thrown
+    // if a mutation throws, the others in the batch are reapplied without it
+    // so they shouldn't have side effects outside of the state
+    template <typename F>
+    void combinedTransaction(F f) {
+        CombineRequest req;
+        req.apply = std::move(f);
+
+        std::unique_lock l(m_combineMutex);
+        m_combineQueue.push_back(&req);
+        while (true) {
+            // woken once per batch: when it's done, or when the next batch needs a combiner
+            m_combineCv.wait(l, [&] { return req.done || !m_combining; });
+            if (req.done) break;
+
+            // only the combiner waits for the transaction lock, the others wait for its batch
+            m_combining = true;
+            l.unlock();
+            this->beginTransaction();
+            combine(); // the batch includes req
+            l.lock();
+        }
+        l.unlock();
+
+        if (req.error) std::rethrow_exception(req.error);
+    }
+
     using kuzco::Root<T>::detach;
     using kuzco::Root<T>::detachedPayload;
+    using kuzco::Root<T>::version;
+    using kuzco::Root<T>::waitForVersion;
+    using kuzco::Root<T>::waitUntil;
+    using kuzco::Root<T>::setJournaling;
+    using kuzco::Root<T>::lastJournal;
+#if KUZCO_HAS_COROUTINES
+    using kuzco::Root<T>::waitForVersionAsync;
+    using kuzco::Root<T>::waitUntilAsync;
+#endif
 private:
+    struct CombineRequest : public kuzco::Root<T>::Mutation {
+        bool done = false; // guarded by m_combineMutex
+    };
+
+    std::mutex m_combineMutex;
+    std::condition_variable m_combineCv;
+    std::vector<CombineRequest*> m_combineQueue;
+    bool m_combining = false; // a thread is applying the queue or waiting for the transaction lock to do so
+
+    // must be called in a transaction (and ends it)
+    void combine() {
+        std::vector<CombineRequest*> batch;
+        {
+            std::lock_guard l(m_combineMutex);
+            batch.swap(m_combineQueue);
+        }
+
+        if (kuzco::Root<T>::applyMutations(batch.begin(), batch.end())) {
+            notifySubscribers();
+        }
+
+        {
+            std::lock_guard l(m_combineMutex);
+            for (auto r : batch) r->done = true;
+            m_combining = false;
+        }
+        m_combineCv.notify_all();
+    }
+
     void endTransaction(bool store) {
-        kuzco::Root<T>::endTransaction(store);
-        if (store) {
+        if (kuzco::Root<T>::endTransaction(store)) {
             // only notify on stored transactions
-            // Publisher<StateRoot<T>>::notifySubscribers(*this);
+            notifySubscribers();
         }
     }
+
+    // called after a publish, outside of the transaction lock
+    // another root may have been published in the meantime, in which case its state is sent twice
+    // and the publisher drops the second one
+    // (the version is read first, so the state is never older than the version)
+    void notifySubscribers() {
+        auto version = this->version();
+        kuzco::Publisher<T>::notifySubscribers(version, this->detachedPayload());
+    }
 };
 
 class ForwardDeclared;
@@ -0,0 +1,101 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+// reader scaling: loads per second of the detached root with 1 to 64 reader threads
+// while a writer publishes a new root every 100us
+//
+// usage: bench-readers [max threads] [ms per run]
+//
+#include <kuzco/Root.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kuzco;
+using Clock = std::chrono::steady_clock;
+
+std::atomic_uint64_t sink; // keeps the reads from being optimized away
+
+struct State
+{
+    int a = 0;
+    Node<std::string> name;
+};
+
+// returns loads per second
+template <typename Read>
+double run(Root<State>& root, int numThreads, int ms, Read read)
+{
+    std::atomic_bool start = false, stop = false;
+    std::atomic_uint64_t total = 0;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i)
+    {
+        threads.emplace_back([&] {
+            while (!start) std::this_thread::yield();
+            uint64_t n = 0, sum = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                sum += read(root);
+                ++n;
+            }
+            total += n;
+            sink += sum;
+        });
+    }
+
+    std::thread writer([&] {
+        while (!start) std::this_thread::yield();
+        int i = 0;
+        while (!stop)
+        {
+            root.beginTransaction();
+            root.transactionData()->a = ++i;
+            root.endTransaction();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    auto begin = Clock::now();
+    start = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    stop = true;
+    for (auto& t : threads) t.join();
+    writer.join();
+    auto seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    return double(total) / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    const int maxThreads = argc > 1 ? std::atoi(argv[1]) : 64;
+    const int ms = argc > 2 ? std::atoi(argv[2]) : 500;
+
+    Root<State> detachRoot(Node<State>{});
+    Root<State> epochRoot(Node<State>{});
+    epochRoot.enableEpochReads();
+
+    auto detach = [](Root<State>& r) { return uint64_t(r.detach()->a); };
+    auto read = [](Root<State>& r) { return uint64_t(r.read([](const State& s) { return s.a; })); };
+
+    std::printf("%8s %16s %16s\n", "threads", "detach Mloads/s", "read Mloads/s");
+    for (int n = 1; n <= maxThreads; n *= 2)
+    {
+        auto d = run(detachRoot, n, ms, detach);
+        auto r = run(epochRoot, n, ms, read);
+        std::printf("%8d %16.2f %16.2f\n", n, d / 1e6, r / 1e6);
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "impl/CurrentStack.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+namespace kuzco
+{
+
+// allocation policy for node payloads
+// a root can be given an allocator and all payloads created in its transactions will come from it
+//
+// allocators are reference counted
+// the handle which creates the allocator holds a reference and so does every live allocation
+// thus an allocator outlives its root for as long as there are detached snapshots allocated from it
+//
+// payloads are allocated only from the thread which performs a transaction, but they may be
+// deallocated from any thread (typically by readers releasing old snapshots)
+class Allocator
+{
+public:
+    Allocator() { registerSelf(); }
+
+    Allocator(const Allocator&) = delete;
+    Allocator& operator=(const Allocator&) = delete;
+
+    virtual void* allocate(std::size_t size, std::size_t alignment) = 0;
+    virtual void deallocate(void* p, std::size_t size, std::size_t alignment) noexcept = 0;
+
+    // called by the root on the transaction thread when a transaction begins and ends
+    // the allocator is current for the thread between the two calls
+    virtual void transactionBegin() {}
+    virtual void transactionEnd(bool /*stored*/) {}
+
+    void addRef() noexcept { m_refCount.fetch_add(1, std::memory_order_relaxed); }
+    void release() noexcept
+    {
+        if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    // id of the allocator stored in payload blocks
+    // zero means the allocator could not be registered and payloads use the global heap
+    uint32_t id() const noexcept { return m_id; }
+
+    static Allocator* fromId(uint32_t id) noexcept { return registry()[id].load(std::memory_order_acquire); }
+
+    // the allocator for payloads constructed on the current thread (null for the global heap)
+    static Allocator* current() noexcept { return tlCurrent(); }
+
+    // sets the current allocator for the current thread and returns the previous one
+    static Allocator* setCurrent(Allocator* a) noexcept
+    {
+        auto ret = tlCurrent();
+        tlCurrent() = a;
+        return ret;
+    }
+
+    // make a current for a transaction of owner on this thread until popCurrent(owner)
+    // transactions of different roots can end in any order (see impl::CurrentStack)
+    static void pushCurrent(const void* owner, Allocator* a) { tlStack().push(owner, a, tlCurrent()); }
+    static void popCurrent(const void* owner) noexcept { tlStack().pop(owner, tlCurrent()); }
+
+protected:
+    virtual ~Allocator()
+    {
+        if (m_id) registry()[m_id].store(nullptr, std::memory_order_release);
+    }
+
+private:
+    static constexpr uint32_t Max_Allocators = 4096;
+
+    static std::atomic<Allocator*>* registry() noexcept
+    {
+        static std::atomic<Allocator*> r[Max_Allocators] = {};
+        return r;
+    }
+
+    static Allocator*& tlCurrent() noexcept
+    {
+        static thread_local Allocator* a = nullptr;
+        return a;
+    }
+
+    static impl::CurrentStack<Allocator>& tlStack() noexcept
+    {
+        static thread_local impl::CurrentStack<Allocator> s;
+        return s;
+    }
+
+    void registerSelf() noexcept
+    {
+        auto r = registry();
+        // zero is reserved for "no allocator"
+        for (uint32_t i = 1; i < Max_Allocators; ++i)
+        {
+            Allocator* expected = nullptr;
+            if (r[i].compare_exchange_strong(expected, this, std::memory_order_acq_rel))
+            {
+                m_id = i;
+                return;
+            }
+        }
+    }
+
+    std::atomic_size_t m_refCount = 1;
+    uint32_t m_id = 0;
+};
+
+// owning handle of an allocator
+class AllocatorRef
+{
+public:
+    AllocatorRef() noexcept = default;
+    AllocatorRef(std::nullptr_t) noexcept {}
+
+    AllocatorRef(const AllocatorRef& other) noexcept : m_allocator(other.m_allocator)
+    {
+        if (m_allocator) m_allocator->addRef();
+    }
+    AllocatorRef(AllocatorRef&& other) noexcept : m_allocator(other.m_allocator) { other.m_allocator = nullptr; }
+
+    AllocatorRef& operator=(AllocatorRef other) noexcept
+    {
+        std::swap(m_allocator, other.m_allocator);
+        return *this;
+    }
+
+    ~AllocatorRef() { if (m_allocator) m_allocator->release(); }
+
+    // creates a new allocator of type A (the returned handle holds its initial reference)
+    template <typename A, typename... Args>
+    static AllocatorRef make(Args&&... args)
+    {
+        AllocatorRef ret;
+        ret.m_allocator = new A(std::forward<Args>(args)...);
+        return ret;
+    }
+
+    Allocator* get() const noexcept { return m_allocator; }
+    Allocator* operator->() const noexcept { return m_allocator; }
+    explicit operator bool() const noexcept { return !!m_allocator; }
+
+private:
+    Allocator* m_allocator = nullptr;
+};
+
+} // namespace kuzco
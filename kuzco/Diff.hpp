@@ -0,0 +1,191 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Node.hpp"
+
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+namespace kuzco
+{
+
+// a named member of a class, for diffs
+template <typename Class, typename M>
+struct Field
+{
+    const char* name;
+    M Class::* ptr;
+};
+
+template <typename Class, typename M>
+constexpr Field<Class, M> field(const char* name, M Class::* ptr) { return {name, ptr}; }
+
+// to make a type diffable member by member, declare a function in its namespace which lists its fields:
+//
+// inline auto kuzcoFields(const Foo*)
+// {
+//     return std::make_tuple(kuzco::field("a", &Foo::a), kuzco::field("b", &Foo::b));
+// }
+//
+// (the argument is always null, it only selects the type)
+// types without fields are compared as a whole
+
+// a changed value
+// path is made of field names: "/a/b" is the field b of the field a of the root
+// the values point inside the snapshots of the diff and are valid while it's alive
+// a null value means there was none (an empty OptNode)
+struct DiffChange
+{
+    std::string path;
+    const std::type_info* type;
+    const void* oldData;
+    const void* newData;
+
+    template <typename U>
+    const U* oldAs() const { return *type == typeid(U) ? static_cast<const U*>(oldData) : nullptr; }
+    template <typename U>
+    const U* newAs() const { return *type == typeid(U) ? static_cast<const U*>(newData) : nullptr; }
+};
+
+namespace impl
+{
+template <typename T, typename = void>
+struct HasFields : std::false_type {};
+template <typename T>
+struct HasFields<T, std::void_t<decltype(kuzcoFields(static_cast<const T*>(nullptr)))>> : std::true_type {};
+
+template <typename T, typename = void>
+struct IsEqualityComparable : std::false_type {};
+template <typename T>
+struct IsEqualityComparable<T, std::void_t<decltype(bool(std::declval<const T&>() == std::declval<const T&>()))>> : std::true_type {};
+
+template <typename M>
+struct IsHandle : std::false_type {};
+template <typename U, typename E>
+struct IsHandle<Node<U, E>> : std::true_type {};
+template <typename U>
+struct IsHandle<OptNode<U>> : std::true_type {};
+template <typename U, typename E>
+struct IsHandle<Detached<U, E>> : std::true_type {};
+template <typename U>
+struct IsHandle<OptDetached<U>> : std::true_type {};
+
+// walks two objects and records the differences
+// subtrees which are shared by both (same payload) are skipped, so the cost is proportional to the changes
+class Differ
+{
+public:
+    explicit Differ(std::vector<DiffChange>& out) : m_out(out) {}
+
+    // a and b are payload values and a != b
+    template <typename U>
+    void object(const U* a, const U* b)
+    {
+        using V = std::remove_const_t<U>;
+        if constexpr (HasFields<V>::value)
+        {
+            if (a && b) return fields<V>(*a, *b);
+        }
+        record<V>(a, b);
+    }
+
+private:
+    template <typename V>
+    void fields(const V& a, const V& b)
+    {
+        std::apply([&](auto... f) {
+            (member(f.name, a.*(f.ptr), b.*(f.ptr)), ...);
+        }, kuzcoFields(static_cast<const V*>(nullptr)));
+    }
+
+    template <typename M>
+    void member(const char* name, const M& a, const M& b)
+    {
+        const auto len = m_path.size();
+        m_path += '/';
+        m_path += name;
+        value(a, b);
+        m_path.resize(len);
+    }
+
+    template <typename M>
+    void value(const M& a, const M& b)
+    {
+        if constexpr (IsHandle<M>::value)
+        {
+            // shallow comparison (by value for inline leaves)
+            if (a != b) object(a.qget(), b.qget());
+        }
+        else if constexpr (HasFields<M>::value)
+        {
+            fields<M>(a, b);
+        }
+        else if constexpr (IsEqualityComparable<M>::value)
+        {
+            if (!(a == b)) record<M>(&a, &b);
+        }
+        else
+        {
+            // nothing to compare with
+            // the owner was changed, so this may have been changed as well
+            record<M>(&a, &b);
+        }
+    }
+
+    template <typename V>
+    void record(const V* a, const V* b)
+    {
+        m_out.push_back({m_path, &typeid(V), a, b});
+    }
+
+    std::vector<DiffChange>& m_out;
+    std::string m_path;
+};
+} // namespace impl
+
+// differences between two snapshots
+// the snapshots are kept alive by the diff, so the changed values can be accessed through it
+// fields are listed in declaration order, depth first
+//
+// values of Node and OptNode fields are compared by payload and only changed ones are visited
+// (so it only walks the nodes which were cloned by the transactions between the snapshots)
+// values of other fields are compared with operator== if they have one
+// (note that operator== of a std::vector of nodes is also shallow)
+// other values are reported as changed whenever their owner has changed
+template <typename T>
+class Diff
+{
+public:
+    Diff(Detached<T> oldRoot, Detached<T> newRoot)
+        : m_old(std::move(oldRoot))
+        , m_new(std::move(newRoot))
+    {
+        if (m_old != m_new) impl::Differ(m_changes).object(m_old.get(), m_new.get());
+    }
+
+    const Detached<T>& oldRoot() const { return m_old; }
+    const Detached<T>& newRoot() const { return m_new; }
+
+    const std::vector<DiffChange>& changes() const { return m_changes; }
+    bool empty() const { return m_changes.empty(); }
+
+    auto begin() const { return m_changes.begin(); }
+    auto end() const { return m_changes.end(); }
+
+private:
+    Detached<T> m_old;
+    Detached<T> m_new;
+    std::vector<DiffChange> m_changes;
+};
+
+} // namespace kuzco
@@ -0,0 +1,148 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "impl/CurrentStack.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+namespace kuzco
+{
+
+template <typename T>
+class Root;
+
+// the nodes replaced (cloned or reassigned) by a transaction in the order of replacement
+// recorded only if journaling is enabled for the root (see Root::setJournaling)
+//
+// the data pointers are identities: they can be compared with the payloads of nodes in snapshots
+// but the old ones may have been destroyed already (unless a snapshot which has them is alive)
+//
+// the parent of an entry is the entry whose new data contains the replaced node
+// nodes are always replaced after their parents (a parent must be writable to get a writable child)
+// so parents precede their children
+// nodes which don't live directly in a payload (for example in the buffer of a std::vector) have no parent
+class Journal
+{
+public:
+    struct Entry
+    {
+        const void* node; // the handle which was replaced
+        const void* oldData; // null if the node was empty
+        const void* newData;
+        std::size_t size; // of the new data, zero if it was replaced again by the same transaction
+        const std::type_info* type;
+        int parent; // index of the parent entry or -1 (for the root or if unknown)
+    };
+
+    const std::vector<Entry>& entries() const { return m_entries; }
+    bool empty() const { return m_entries.empty(); }
+
+    // version of the root the transaction published
+    uint64_t version() const { return m_version; }
+
+    // indices of the ancestors of an entry, nearest first
+    std::vector<int> ancestors(int index) const
+    {
+        std::vector<int> ret;
+        for (int p = m_entries[index].parent; p >= 0; p = m_entries[p].parent) ret.push_back(p);
+        return ret;
+    }
+
+    // the journal of the transaction in progress on this thread (if any)
+    static Journal* current() { return currentRef(); }
+
+    template <typename T>
+    void record(const void* node, const T* oldData, const T* newData)
+    {
+        const int index = int(m_entries.size());
+
+        // the entry whose new data contains the node
+        const auto n = reinterpret_cast<uintptr_t>(node);
+        int parent = -1;
+        auto c = m_byData.upper_bound(n);
+        if (c != m_byData.begin())
+        {
+            --c;
+            if (n < c->first + m_entries[c->second].size) parent = c->second;
+        }
+
+        auto [last, added] = m_byNode.try_emplace(node, index);
+        if (!added)
+        {
+            // the data it had is gone, it can't be a parent any more
+            unindexData(last->second);
+            m_entries[last->second].size = 0;
+            last->second = index;
+        }
+
+        m_entries.push_back({node, oldData, newData, sizeof(T), &typeid(T), parent});
+        if (newData) m_byData[reinterpret_cast<uintptr_t>(newData)] = index;
+    }
+
+    // a node already replaced in this transaction got new data again
+    template <typename T>
+    void rebind(const void* node, const T* oldData, const T* newData)
+    {
+        auto last = m_byNode.find(node);
+        if (last == m_byNode.end()) return;
+        const int index = last->second;
+        auto& e = m_entries[index];
+        if (e.newData != oldData) return;
+        unindexData(index);
+        e.newData = newData;
+        if (newData) m_byData[reinterpret_cast<uintptr_t>(newData)] = index;
+    }
+
+private:
+    template <typename T>
+    friend class Root;
+
+    static Journal*& currentRef()
+    {
+        static thread_local Journal* j = nullptr;
+        return j;
+    }
+
+    static impl::CurrentStack<Journal>& stack()
+    {
+        static thread_local impl::CurrentStack<Journal> s;
+        return s;
+    }
+
+    // current for the transaction of owner until popCurrent(owner)
+    static void pushCurrent(const void* owner, Journal* j) { stack().push(owner, j, currentRef()); }
+    static void popCurrent(const void* owner) noexcept { stack().pop(owner, currentRef()); }
+
+    void unindexData(int index)
+    {
+        auto d = m_byData.find(reinterpret_cast<uintptr_t>(m_entries[index].newData));
+        if (d != m_byData.end() && d->second == index) m_byData.erase(d);
+    }
+
+    // the indices are only needed while recording
+    void seal()
+    {
+        m_byNode = {};
+        m_byData = {};
+    }
+
+    std::vector<Entry> m_entries;
+    uint64_t m_version = 0;
+
+    // so that recording is O(log n) instead of a scan of all entries
+    std::unordered_map<const void*, int> m_byNode; // the last entry of each node
+    std::map<uintptr_t, int> m_byData; // entries by the address of their new data (superseded ones excluded)
+};
+
+} // namespace kuzco
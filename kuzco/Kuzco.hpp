@@ -9,4 +9,20 @@
 
 // core
 #include "Root.hpp"
+#include "WriterThread.hpp"
+#include "Publisher.hpp"
+#include "Diff.hpp"
+#include "Journal.hpp"
+#include "Selector.hpp"
 
+// containers
+#include "Vector.hpp"
+#include "Map.hpp"
+#include "OrderedMap.hpp"
+
+// allocators
+#include "PoolAllocator.hpp"
+#include "TransactionArena.hpp"
+
+// reclamation
+#include "Reclaimer.hpp"
@@ -0,0 +1,497 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Payload.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace kuzco
+{
+
+namespace impl
+{
+namespace hamt
+{
+constexpr uint32_t Bits = 5;
+constexpr uint32_t Mask = (1 << Bits) - 1;
+constexpr uint32_t Hash_Bits = sizeof(size_t) * 8;
+constexpr uint32_t Max_Depth = (Hash_Bits + Bits - 1) / Bits + 1; // the last level is for collisions
+
+// a node of the trie
+// entries and children are ordered by the hash bits of their level and indexed through bitmaps
+// when the hash is exhausted, keys with the same hash are all held as entries of a collision node
+template <typename K, typename V>
+struct Node
+{
+    uint32_t dataMap = 0;
+    uint32_t nodeMap = 0;
+    bool collision = false;
+    std::vector<std::pair<K, V>> entries;
+    std::vector<Payload<Node>> children;
+
+    // position of the element for bit: the number of elements with lower bits
+    static uint32_t index(uint32_t map, uint32_t bit) { return popcount(map & (bit - 1)); }
+
+    static uint32_t popcount(uint32_t x)
+    {
+        x = x - ((x >> 1) & 0x55555555);
+        x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+        return (((x + (x >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+    }
+};
+
+inline uint32_t bitOf(size_t hash, uint32_t shift) { return 1u << ((hash >> shift) & Mask); }
+} // namespace hamt
+} // namespace impl
+
+// persistent hash map
+// a hash array mapped trie with a branching factor of 32
+// copies are O(1) and share everything
+// lookups, inserts and erases are O(log32 n) and clone only the path to the changed entry
+//
+// nodes follow the same rules as nodes of the state:
+// a node is edited in place if the map is its only owner, otherwise it's cloned first
+// so the first edit of a map cloned in a transaction clones only the path to the edited entry
+// and subsequent edits of the same part are in place
+// nodes are payloads, so they come from the current allocator
+//
+// values can be kuzco nodes: Map<std::string, Node<Session>>
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class Map
+{
+    using HNode = impl::hamt::Node<K, V>;
+    static constexpr uint32_t Bits = impl::hamt::Bits;
+    static constexpr uint32_t Hash_Bits = impl::hamt::Hash_Bits;
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using size_type = size_t;
+
+    class const_iterator;
+
+    Map() = default;
+
+    Map(std::initializer_list<value_type> list)
+        : Map(list.begin(), list.end())
+    {}
+
+    // the shape of the trie depends only on the keys, so there is nothing to gain from a bottom up build
+    // the nodes are unique to the new map and are edited in place
+    template <typename It, typename = typename std::iterator_traits<It>::iterator_category>
+    Map(It first, It last)
+    {
+        for (; first != last; ++first)
+        {
+            auto&& e = *first;
+            set(e.first, e.second);
+        }
+    }
+
+    Map(const Map&) = default;
+    Map& operator=(const Map&) = default;
+
+    Map(Map&& other) noexcept { swap(other); }
+    Map& operator=(Map&& other) noexcept
+    {
+        Map(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void swap(Map& other) noexcept
+    {
+        m_root.swap(other.m_root);
+        std::swap(m_size, other.m_size);
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+
+    // null if there is no such key
+    const V* find(const K& key) const
+    {
+        auto e = findEntry(key);
+        return e ? &e->second : nullptr;
+    }
+
+    bool contains(const K& key) const { return !!findEntry(key); }
+    size_t count(const K& key) const { return contains(key); }
+
+    const V& at(const K& key) const
+    {
+        auto v = find(key);
+        if (!v) throw std::out_of_range("kuzco::Map::at");
+        return *v;
+    }
+
+    // inserts or assigns
+    // returns true if the key is new
+    bool set(K key, V value)
+    {
+        return set(std::move(key), std::move(value), true);
+    }
+
+    // inserts only if the key is not in the map
+    // returns true if it was inserted
+    bool insert(K key, V value)
+    {
+        if (contains(key)) return false;
+        return set(std::move(key), std::move(value));
+    }
+
+    // calls f(V&) with the value of key, cloning the nodes on the path to it if they are shared
+    // returns false if there is no such key (and nothing is cloned)
+    template <typename F>
+    bool update(const K& key, F f)
+    {
+        if (!contains(key)) return false;
+        f(*editableFind(key));
+        return true;
+    }
+
+    // returns false if there is no such key (and nothing is cloned)
+    bool erase(const K& key)
+    {
+        if (!contains(key)) return false;
+        return eraseUnchecked(key);
+    }
+
+    void clear() noexcept
+    {
+        m_root.reset();
+        m_size = 0;
+    }
+
+    class Transient;
+
+    // a transient of a map moved into it doesn't share its nodes with anything,
+    // a transient of a copy clones the nodes it edits first
+    Transient transient() const& { return Transient(*this); }
+    Transient transient() && { return Transient(std::move(*this)); }
+
+    const_iterator begin() const { return const_iterator(m_root.get()); }
+    const_iterator end() const { return const_iterator(); }
+
+    // maps which share their root are equal without comparing the entries
+    template <typename U = V, typename = decltype(std::declval<const U&>() == std::declval<const U&>())>
+    bool operator==(const Map& other) const
+    {
+        if (m_size != other.m_size) return false;
+        if (m_root == other.m_root) return true;
+        for (auto& e : *this)
+        {
+            auto v = other.find(e.first);
+            if (!v || !(*v == e.second)) return false;
+        }
+        return true;
+    }
+
+    template <typename U = V, typename = decltype(std::declval<const U&>() == std::declval<const U&>())>
+    bool operator!=(const Map& other) const { return !(*this == other); }
+
+    // entries are visited depth first, in no particular order
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<K, V>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        const_iterator() = default;
+
+        reference operator*() const { return *m_cur; }
+        pointer operator->() const { return m_cur; }
+
+        const_iterator& operator++() { advance(); return *this; }
+        const_iterator operator++(int) { auto ret = *this; advance(); return ret; }
+
+        bool operator==(const const_iterator& b) const { return m_cur == b.m_cur; }
+        bool operator!=(const const_iterator& b) const { return m_cur != b.m_cur; }
+
+    private:
+        friend class Map;
+        explicit const_iterator(const HNode* root)
+        {
+            if (!root) return;
+            m_stack[0] = {root, 0, 0};
+            m_depth = 1;
+            advance();
+        }
+
+        void advance()
+        {
+            while (m_depth)
+            {
+                auto& f = m_stack[m_depth - 1];
+                if (f.entry < f.node->entries.size())
+                {
+                    m_cur = &f.node->entries[f.entry++];
+                    return;
+                }
+                if (f.child < f.node->children.size())
+                {
+                    auto child = f.node->children[f.child++].get();
+                    m_stack[m_depth++] = {child, 0, 0};
+                    continue;
+                }
+                --m_depth;
+            }
+            m_cur = nullptr;
+        }
+
+        struct Frame
+        {
+            const HNode* node;
+            uint32_t entry;
+            uint32_t child;
+        };
+        Frame m_stack[impl::hamt::Max_Depth + 1];
+        uint32_t m_depth = 0;
+        const value_type* m_cur = nullptr;
+    };
+
+    // a builder for bulk edits
+    // the transient owns its map exclusively (it's move-only), so the nodes it clones stay unique to it
+    // and are edited in place from then on, the same as unique nodes in a transaction
+    // unlike the edits of a map, edits of missing keys may clone the path to where the key would be,
+    // which saves the extra lookup each of them needs to avoid that
+    class Transient
+    {
+    public:
+        explicit Transient(Map map) : m_map(std::move(map)) {}
+
+        Transient(const Transient&) = delete;
+        Transient& operator=(const Transient&) = delete;
+        Transient(Transient&&) noexcept = default;
+        Transient& operator=(Transient&&) noexcept = default;
+
+        size_t size() const { return m_map.size(); }
+        bool empty() const { return m_map.empty(); }
+        const V* find(const K& key) const { return m_map.find(key); }
+        bool contains(const K& key) const { return m_map.contains(key); }
+
+        bool set(K key, V value) { return m_map.set(std::move(key), std::move(value), true); }
+        bool insert(K key, V value) { return m_map.set(std::move(key), std::move(value), false); }
+
+        template <typename F>
+        bool update(const K& key, F f)
+        {
+            auto v = m_map.editableFind(key);
+            if (!v) return false;
+            f(*v);
+            return true;
+        }
+
+        bool erase(const K& key) { return m_map.eraseUnchecked(key); }
+
+        // the edited map (the transient is left empty)
+        Map persistent() { return std::move(m_map); }
+
+    private:
+        Map m_map;
+    };
+
+private:
+    // inserts, and assigns if assign is true
+    bool set(K&& key, V&& value, bool assign)
+    {
+        if (!m_root) m_root = Payload<HNode>::make();
+        const auto hash = Hash{}(key);
+        const bool inserted = set(m_root, 0, hash, std::move(key), std::move(value), assign);
+        m_size += inserted;
+        return inserted;
+    }
+
+    // clones the nodes on the path to key even if there is no such key
+    V* editableFind(const K& key)
+    {
+        if (!m_root) return nullptr;
+        const auto hash = Hash{}(key);
+        auto node = &impl::editable(m_root);
+        for (uint32_t shift = 0; !node->collision; shift += Bits)
+        {
+            const auto bit = impl::hamt::bitOf(hash, shift);
+            if (node->dataMap & bit)
+            {
+                auto& e = node->entries[HNode::index(node->dataMap, bit)];
+                return Eq{}(e.first, key) ? &e.second : nullptr;
+            }
+            if (!(node->nodeMap & bit)) return nullptr;
+            node = &impl::editable(node->children[HNode::index(node->nodeMap, bit)]);
+        }
+        for (auto& e : node->entries)
+        {
+            if (Eq{}(e.first, key)) return &e.second;
+        }
+        return nullptr;
+    }
+
+    // clones the nodes on the path to key even if there is no such key
+    bool eraseUnchecked(const K& key)
+    {
+        if (!m_root || !erase(m_root, 0, Hash{}(key), key)) return false;
+        if (!--m_size) m_root.reset();
+        return true;
+    }
+
+    const value_type* findEntry(const K& key) const
+    {
+        if (!m_root) return nullptr;
+        const auto hash = Hash{}(key);
+        const HNode* node = m_root.get();
+        for (uint32_t shift = 0; !node->collision; shift += Bits)
+        {
+            const auto bit = impl::hamt::bitOf(hash, shift);
+            if (node->dataMap & bit)
+            {
+                auto& e = node->entries[HNode::index(node->dataMap, bit)];
+                return Eq{}(e.first, key) ? &e : nullptr;
+            }
+            if (!(node->nodeMap & bit)) return nullptr;
+            node = node->children[HNode::index(node->nodeMap, bit)].get();
+        }
+        for (auto& e : node->entries)
+        {
+            if (Eq{}(e.first, key)) return &e;
+        }
+        return nullptr;
+    }
+
+    static bool set(Payload<HNode>& p, uint32_t shift, size_t hash, K&& key, V&& value, bool assign)
+    {
+        auto& node = impl::editable(p);
+        if (node.collision)
+        {
+            for (auto& e : node.entries)
+            {
+                if (!Eq{}(e.first, key)) continue;
+                if (assign) e.second = std::move(value);
+                return false;
+            }
+            node.entries.emplace_back(std::move(key), std::move(value));
+            return true;
+        }
+
+        const auto bit = impl::hamt::bitOf(hash, shift);
+        if (node.dataMap & bit)
+        {
+            const auto i = HNode::index(node.dataMap, bit);
+            auto& e = node.entries[i];
+            if (Eq{}(e.first, key))
+            {
+                if (assign) e.second = std::move(value);
+                return false;
+            }
+
+            // two keys in the same slot: push both one level down
+            const auto otherHash = Hash{}(e.first);
+            auto child = pair(shift + Bits, std::move(e), otherHash, {std::move(key), std::move(value)}, hash);
+            node.entries.erase(node.entries.begin() + i);
+            node.dataMap ^= bit;
+            node.nodeMap |= bit;
+            node.children.insert(node.children.begin() + HNode::index(node.nodeMap, bit), std::move(child));
+            return true;
+        }
+
+        if (node.nodeMap & bit)
+        {
+            return set(node.children[HNode::index(node.nodeMap, bit)], shift + Bits, hash, std::move(key), std::move(value), assign);
+        }
+
+        node.dataMap |= bit;
+        node.entries.emplace(node.entries.begin() + HNode::index(node.dataMap, bit), std::move(key), std::move(value));
+        return true;
+    }
+
+    // a node with two entries with different keys
+    static Payload<HNode> pair(uint32_t shift, value_type&& a, size_t ha, value_type&& b, size_t hb)
+    {
+        auto ret = Payload<HNode>::make();
+        if (shift >= Hash_Bits)
+        {
+            ret->collision = true;
+            ret->entries.push_back(std::move(a));
+            ret->entries.push_back(std::move(b));
+            return ret;
+        }
+
+        const auto bitA = impl::hamt::bitOf(ha, shift);
+        const auto bitB = impl::hamt::bitOf(hb, shift);
+        if (bitA == bitB)
+        {
+            ret->nodeMap = bitA;
+            ret->children.push_back(pair(shift + Bits, std::move(a), ha, std::move(b), hb));
+        }
+        else
+        {
+            ret->dataMap = bitA | bitB;
+            if (bitA > bitB) std::swap(a, b);
+            ret->entries.push_back(std::move(a));
+            ret->entries.push_back(std::move(b));
+        }
+        return ret;
+    }
+
+    // returns false if there is no such key
+    static bool erase(Payload<HNode>& p, uint32_t shift, size_t hash, const K& key)
+    {
+        auto& node = impl::editable(p);
+        if (node.collision)
+        {
+            for (auto i = node.entries.begin(); i != node.entries.end(); ++i)
+            {
+                if (!Eq{}(i->first, key)) continue;
+                node.entries.erase(i);
+                return true;
+            }
+            return false;
+        }
+
+        const auto bit = impl::hamt::bitOf(hash, shift);
+        if (node.dataMap & bit)
+        {
+            const auto i = HNode::index(node.dataMap, bit);
+            if (!Eq{}(node.entries[i].first, key)) return false;
+            node.entries.erase(node.entries.begin() + i);
+            node.dataMap ^= bit;
+            return true;
+        }
+
+        if (!(node.nodeMap & bit)) return false;
+        const auto ci = HNode::index(node.nodeMap, bit);
+        auto& child = node.children[ci];
+        if (!erase(child, shift + Bits, hash, key)) return false;
+
+        // a child with a single entry is merged back into its parent
+        // (so the shape of the trie depends only on its contents)
+        if (child->children.empty() && child->entries.size() == 1)
+        {
+            auto e = std::move(impl::editable(child).entries.front());
+            node.children.erase(node.children.begin() + ci);
+            node.nodeMap ^= bit;
+            node.dataMap |= bit;
+            node.entries.insert(node.entries.begin() + HNode::index(node.dataMap, bit), std::move(e));
+        }
+        return true;
+    }
+
+    Payload<HNode> m_root; // null if empty
+    size_t m_size = 0;
+};
+
+} // namespace kuzco
@@ -8,9 +8,11 @@
 #pragma once
 
 #include "impl/Data.hpp"
+#include "Journal.hpp"
 
 #include <vector>
 #include <type_traits>
+#include <cstring>
 
 namespace kuzco
 {
@@ -19,6 +21,7 @@ namespace impl
 {
 template <typename T>
 class BasicNode;
+class Merger;
 } // namespace impl
 
 template <typename T>
@@ -26,6 +29,19 @@ class Root;
 
 namespace impl
 {
+// small trivially copyable leaves are stored inline in their handles with value semantics
+// there is nothing to share for them: copying the value is as cheap as copying a pointer
+template <typename T>
+inline constexpr bool IsInlineLeaf = std::is_trivially_copyable_v<T>
+    && sizeof(T) <= sizeof(void*) && alignof(T) <= alignof(void*);
+
+// for inline values, identity is the value itself
+// compared bitwise, since trivially copyable types are not required to have operator==
+template <typename T>
+bool sameBits(const T& a, const T& b)
+{
+    return std::memcmp(&a, &b, sizeof(T)) == 0;
+}
 
 template <typename T>
 class DataHolder
@@ -33,8 +49,8 @@ class DataHolder
 public:
     using Type = T;
 
-    std::shared_ptr<const T> payload() const { return m_data.payload; }
-    const T* qget() const { return this->m_data.qdata; }
+    Payload<const T> payload() const { return m_data.payload(); }
+    const T* qget() const { return this->m_data.get(); }
 
     // shallow comparisons
     template <typename U>
@@ -50,8 +66,10 @@ public:
     }
 
 protected:
-    T* qget() { return this->m_data.qdata; }
+    T* qget() { return this->m_data.get(); }
     impl::Data<T> m_data;
+
+    friend class Merger;
 };
 
 // base class for nodes
@@ -62,14 +80,14 @@ public:
     void attachTo(const BasicNode& n)
     {
         this->m_data = n.m_data;
-        m_unique = false; // attached nodes are not unique (obviously)
+        setUnique(false); // attached nodes are not unique (obviously)
     }
 
 protected:
     // returns if the object is unique and its data is safe to edit in place
     // if the we're working on new objects, we're unique since no one else has a pointer to it
     // if we're inisde a transaction, we check whether this same transaction has replaced the object already
-    bool unique() const { return m_unique; }
+    bool unique() const { return this->m_data.flag(); }
 
     // unique is different from (use_count == 1)
     // for new (local) objects and in a transaction you could get the payload of a unique object
@@ -79,33 +97,46 @@ protected:
     // as we do when we move-assign objects
 
     // it's populated in the constructors appropriately
-    bool m_unique = true; // an object is unique when intiially constructed
+    // it's stored in the lowest bit of the data pointer, so a node is as big as a pointer
+    void setUnique(bool u) { this->m_data.setFlag(u); }
+
+    BasicNode() { setUnique(true); } // an object is unique when intiially constructed
 
     // for move constructors
     // take the data from another object and invalidate it
     void takeData(BasicNode& other)
     {
         this->m_data = std::move(other.m_data);
-        other.m_data = {};
-        m_unique = other.m_unique; // copy uniqueness
+        setUnique(other.unique()); // copy uniqueness
     }
 
     // replaces the object's data with new data
     // only valid in a trasaction and if not unique
     void replaceWith(Data<T> data)
     {
+        if (auto j = Journal::current()) j->record(this, this->m_data.get(), data.get());
         this->m_data = std::move(data);
-        m_unique = true; // we're replaced so we're once more unique
+        setUnique(true); // we're replaced so we're once more unique
     }
 
     // perform the unique check
     // create new data if needed
     // reassign data from other source
+    // the result is unique only if other was: its data may still be shared
+    // (other can be a copy of a node of a snapshot, or an element shifted in a container)
     void checkedReplace(BasicNode& other)
     {
-        if (unique()) this->m_data = std::move(other.m_data);
-        else replaceWith(std::move(other.m_data));
-        other.m_data = {};
+        const bool otherUnique = other.unique();
+        if (unique())
+        {
+            if (auto j = Journal::current()) j->rebind(this, this->m_data.get(), other.m_data.get());
+            this->m_data = std::move(other.m_data);
+        }
+        else
+        {
+            replaceWith(std::move(other.m_data));
+        }
+        setUnique(otherUnique);
     }
 
     friend class Root<T>;
@@ -116,14 +147,13 @@ protected:
 // convenience class which wraps a detached immutable object
 // never null
 // has quick access to underlying data
-template <typename T>
+template <typename T, typename = void>
 class Detached : public impl::DataHolder<const T>
 {
 public:
-    Detached(std::shared_ptr<const T> payload)
+    Detached(Payload<const T> payload)
     {
-        this->m_data.qdata = payload.get();
-        this->m_data.payload = std::move(payload);
+        this->m_data = impl::Data<const T>(std::move(payload));
     }
 
     const T* get() const { return this->qget(); }
@@ -131,8 +161,32 @@ public:
     const T& operator*() const { return *get(); }
 };
 
-
+// detached inline value (see IsInlineLeaf)
 template <typename T>
+class Detached<T, std::enable_if_t<impl::IsInlineLeaf<T>>>
+{
+public:
+    using Type = const T;
+
+    explicit Detached(const T& value) : m_value(value) {}
+    Detached(const Payload<const T>& payload) : m_value(*payload) {}
+
+    // there is no payload for inline values, so this allocates a new one
+    Payload<const T> payload() const { return Payload<const T>::make(m_value); }
+
+    const T* qget() const { return &m_value; }
+    const T* get() const { return &m_value; }
+    const T* operator->() const { return get(); }
+    const T& operator*() const { return *get(); }
+
+    bool operator==(const Detached& b) const { return impl::sameBits(m_value, b.m_value); }
+    bool operator!=(const Detached& b) const { return !(*this == b); }
+
+private:
+    T m_value;
+};
+
+template <typename T, typename = void>
 class Node : public impl::BasicNode<T>
 {
 public:
@@ -161,7 +215,7 @@ public:
         }
 
         // in any case we're not unique any more
-        this->m_unique = false;
+        this->setUnique(false);
     }
 
     // this is intentionally deleted
@@ -200,6 +254,46 @@ public:
     Detached<std::remove_const_t<T>> detach() const { return Detached(this->payload()); }
 };
 
+// leaf of a small trivially copyable type (see IsInlineLeaf)
+// the value is stored in the handle, so there are no allocations, no reference counting and no COW
+// the api is the same as the one of other leaves
+// since there are no payloads, comparisons are by value
+template <typename T>
+class Node<const T, std::enable_if_t<impl::IsInlineLeaf<T>>>
+{
+public:
+    using Type = const T;
+
+    template <typename... Args, std::enable_if_t<std::is_constructible_v<T, Args...>, int> = 0>
+    Node(Args&&... args)
+        : m_value(std::forward<Args>(args)...)
+    {}
+
+    Node(const Node&) = default;
+    Node& operator=(const Node&) = default;
+
+    template <typename U, std::enable_if_t<std::is_constructible_v<T, U>, int> = 0>
+    Node& operator=(U&& u)
+    {
+        m_value = T(std::forward<U>(u));
+        return *this;
+    }
+
+    const Node& r() const { return *this; }
+    const T* qget() const { return &m_value; }
+    const T* get() const { return &m_value; }
+    const T* operator->() const { return get(); }
+    const T& operator*() const { return *get(); }
+
+    Detached<T> detach() const { return Detached<T>(m_value); }
+
+    bool operator==(const Node& b) const { return impl::sameBits(m_value, b.m_value); }
+    bool operator!=(const Node& b) const { return !(*this == b); }
+
+private:
+    T m_value;
+};
+
 template <typename T>
 using Leaf = Node<const T>;
 
@@ -212,21 +306,19 @@ public:
 
     OptDetached(const Detached<T>& d)
     {
-        this->m_data.qdata = d.get();
-        this->m_data.payload = d.payload();
+        this->m_data = impl::Data<const T>(d.payload());
     }
 
-    OptDetached(std::shared_ptr<const T> payload)
+    OptDetached(Payload<const T> payload)
     {
-        this->m_data.qdata = payload.get();
-        this->m_data.payload = std::move(payload);
+        this->m_data = impl::Data<const T>(std::move(payload));
     }
 
     const T* get() const { return this->qget(); }
     const T* operator->() const { return get(); }
     const T& operator*() const { return *get(); }
 
-    explicit operator bool() const { return !!this->m_data.qdata; }
+    explicit operator bool() const { return !!this->m_data.get(); }
 };
 
 template <typename T>
@@ -237,10 +329,10 @@ public:
     OptNode(const OptNode& other)
     {
         this->m_data = other.m_data;
-        if (this->m_data.qdata)
+        if (this->m_data.get())
         {
             // no point in making empty opt-nodes non-unique
-            this->m_unique = false;
+            this->setUnique(false);
         }
     }
     OptNode& operator=(const OptNode&) = delete;
@@ -255,7 +347,7 @@ public:
 
     void reset() { this->m_data = {}; }
 
-    explicit operator bool() const { return !!this->m_data.qdata; }
+    explicit operator bool() const { return !!this->m_data.get(); }
 
     const OptNode& r() const { return *this; }
     const T* get() const { return this->qget(); }
@@ -264,7 +356,7 @@ public:
 
     T* get()
     {
-        if (this->m_data.qdata && !this->unique()) this->replaceWith(impl::Data<T>::construct(*r().get()));
+        if (this->m_data.get() && !this->unique()) this->replaceWith(impl::Data<T>::construct(*r().get()));
         return this->qget();
     }
     T* operator->() { return get(); }
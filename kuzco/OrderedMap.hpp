@@ -0,0 +1,807 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Payload.hpp"
+#include "impl/FixedArray.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace kuzco
+{
+
+namespace impl
+{
+namespace btree
+{
+constexpr uint32_t Max = 32; // keys per node
+constexpr uint32_t Min = Max / 2; // for all nodes but the root
+constexpr uint32_t Max_Levels = 17; // enough for any size with at least Min children per node
+
+// keys and values are in separate arrays, so searches only touch keys
+template <typename K, typename V>
+struct Leaf
+{
+    FixedArray<K, Max> keys;
+    FixedArray<V, Max> values;
+
+    uint32_t size() const { return keys.size(); }
+};
+
+// keys[i] is the smallest key of children[i + 1]
+// children are payload blocks of inner nodes or of leaves (if level is 1)
+template <typename K, typename V>
+struct Inner
+{
+    using InnerBlock = typename Payload<Inner>::Block;
+    using LeafBlock = typename Payload<Leaf<K, V>>::Block;
+
+    explicit Inner(uint32_t l) : level(l) {}
+
+    Inner(const Inner& other)
+        : level(other.level)
+        , keys(other.keys)
+        , children(other.children)
+    {
+        for (auto c : children) addRef(c, level - 1);
+    }
+
+    Inner& operator=(const Inner&) = delete;
+
+    ~Inner()
+    {
+        for (auto c : children) release(c, level - 1);
+    }
+
+    uint32_t size() const { return keys.size(); }
+
+    const Inner& inner(uint32_t i) const { return static_cast<InnerBlock*>(children[i])->value; }
+    const Leaf<K, V>& leaf(uint32_t i) const { return static_cast<LeafBlock*>(children[i])->value; }
+
+    static void addRef(void* n, uint32_t level)
+    {
+        if (level) static_cast<InnerBlock*>(n)->addRef();
+        else static_cast<LeafBlock*>(n)->addRef();
+    }
+
+    static void release(void* n, uint32_t level)
+    {
+        if (level) Payload<Inner>::adopt(static_cast<InnerBlock*>(n)).reset();
+        else Payload<Leaf<K, V>>::adopt(static_cast<LeafBlock*>(n)).reset();
+    }
+
+    uint32_t level;
+    FixedArray<K, Max> keys;
+    FixedArray<void*, Max + 1> children;
+};
+
+// impl::editable for an untyped node pointer
+template <typename X>
+X& editable(void*& n)
+{
+    auto p = Payload<X>::adopt(static_cast<typename Payload<X>::Block*>(n));
+    auto& ret = impl::editable(p);
+    n = p.releaseBlock();
+    return ret;
+}
+} // namespace btree
+} // namespace impl
+
+// persistent ordered map
+// a B+ tree with up to 32 keys per node
+// copies are O(1) and share everything
+// lookups, inserts and erases are O(log n) and clone only the path to the changed entry
+// iteration is in key order and there are lower_bound, upper_bound and range for range scans
+//
+// nodes follow the same rules as nodes of the state:
+// a node is edited in place if the map is its only owner, otherwise it's cloned first
+// so the first edit of a map cloned in a transaction clones only the path to the edited entry
+// and subsequent edits of the same part are in place
+// nodes are payloads, so they come from the current allocator
+//
+// since leaves are shared between versions they can't be linked
+// so iterators keep the path from the root (and are invalidated by any change of the map)
+template <typename K, typename V, typename Less = std::less<K>>
+class OrderedMap
+{
+    using Leaf = impl::btree::Leaf<K, V>;
+    using Inner = impl::btree::Inner<K, V>;
+    static constexpr uint32_t Max = impl::btree::Max;
+    static constexpr uint32_t Min = impl::btree::Min;
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using size_type = size_t;
+
+    class const_iterator;
+
+    OrderedMap() = default;
+
+    OrderedMap(std::initializer_list<std::pair<K, V>> list)
+        : OrderedMap(list.begin(), list.end())
+    {}
+
+    // O(n) if the keys are sorted and unique: full leaves are filled one after another
+    // and the tree is built over them bottom up
+    // elements from the first one which is out of order onwards are inserted one by one
+    template <typename It, typename = typename std::iterator_traits<It>::iterator_category>
+    OrderedMap(It first, It last)
+    {
+        std::vector<Payload<Leaf>> leaves;
+        Payload<Leaf> cur;
+        for (; first != last; ++first)
+        {
+            auto&& e = *first;
+            if (cur && !Less{}(cur->keys.back(), e.first)) break;
+            if (!cur || cur->keys.full())
+            {
+                if (cur) leaves.push_back(std::move(cur));
+                cur = Payload<Leaf>::make();
+            }
+            cur->keys.push_back(e.first);
+            cur->values.push_back(e.second);
+            ++m_size;
+        }
+
+        if (cur)
+        {
+            // the last leaf takes elements from the one before it, so that both have at least Min
+            if (!leaves.empty())
+            {
+                auto& prev = *leaves.back();
+                while (cur->size() < Min)
+                {
+                    cur->keys.insert(0, std::move(prev.keys.back()));
+                    cur->values.insert(0, std::move(prev.values.back()));
+                    prev.keys.pop_back();
+                    prev.values.pop_back();
+                }
+            }
+            leaves.push_back(std::move(cur));
+            build(leaves);
+        }
+
+        for (; first != last; ++first)
+        {
+            auto&& e = *first;
+            set(e.first, e.second);
+        }
+    }
+
+    OrderedMap(const OrderedMap& other)
+        : m_root(other.m_root)
+        , m_levels(other.m_levels)
+        , m_size(other.m_size)
+    {
+        if (m_root) Inner::addRef(m_root, m_levels);
+    }
+
+    OrderedMap& operator=(const OrderedMap& other)
+    {
+        OrderedMap(other).swap(*this);
+        return *this;
+    }
+
+    OrderedMap(OrderedMap&& other) noexcept { swap(other); }
+    OrderedMap& operator=(OrderedMap&& other) noexcept
+    {
+        OrderedMap(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~OrderedMap() { clear(); }
+
+    void swap(OrderedMap& other) noexcept
+    {
+        std::swap(m_root, other.m_root);
+        std::swap(m_levels, other.m_levels);
+        std::swap(m_size, other.m_size);
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+
+    // null if there is no such key
+    const V* find(const K& key) const
+    {
+        if (!m_root) return nullptr;
+        auto& leaf = leafFor(key);
+        auto i = lowerBound(leaf.keys, key);
+        if (i == leaf.size() || Less{}(key, leaf.keys[i])) return nullptr;
+        return &leaf.values[i];
+    }
+
+    bool contains(const K& key) const { return !!find(key); }
+    size_t count(const K& key) const { return contains(key); }
+
+    const V& at(const K& key) const
+    {
+        auto v = find(key);
+        if (!v) throw std::out_of_range("kuzco::OrderedMap::at");
+        return *v;
+    }
+
+    // inserts or assigns
+    // returns true if the key is new
+    bool set(K key, V value)
+    {
+        return set(std::move(key), std::move(value), true);
+    }
+
+    // inserts only if the key is not in the map
+    // returns true if it was inserted
+    bool insert(K key, V value)
+    {
+        if (contains(key)) return false;
+        return set(std::move(key), std::move(value));
+    }
+
+    // calls f(V&) with the value of key, cloning the nodes on the path to it if they are shared
+    // returns false if there is no such key (and nothing is cloned)
+    template <typename F>
+    bool update(const K& key, F f)
+    {
+        if (!contains(key)) return false;
+        f(*editableFind(key));
+        return true;
+    }
+
+    // returns false if there is no such key (and nothing is cloned)
+    bool erase(const K& key)
+    {
+        if (!contains(key)) return false;
+        return eraseUnchecked(key);
+    }
+
+    void clear() noexcept
+    {
+        if (m_root) Inner::release(m_root, m_levels);
+        m_root = nullptr;
+        m_levels = 0;
+        m_size = 0;
+    }
+
+    class Transient;
+
+    // a transient of a map moved into it doesn't share its nodes with anything,
+    // a transient of a copy clones the nodes it edits first
+    Transient transient() const& { return Transient(*this); }
+    Transient transient() && { return Transient(std::move(*this)); }
+
+    const_iterator begin() const
+    {
+        const_iterator ret;
+        if (m_root) ret.descendFirst(m_root, m_levels, 0);
+        return ret;
+    }
+    const_iterator end() const { return const_iterator(); }
+
+    // the first element with a key not less than key
+    const_iterator lower_bound(const K& key) const { return bound(key, false); }
+
+    // the first element with a key greater than key
+    const_iterator upper_bound(const K& key) const { return bound(key, true); }
+
+    // the elements with keys in [from, to)
+    struct Range
+    {
+        const_iterator first;
+        const_iterator last;
+        const_iterator begin() const { return first; }
+        const_iterator end() const { return last; }
+    };
+    Range range(const K& from, const K& to) const { return {lower_bound(from), lower_bound(to)}; }
+
+    // maps which share their root are equal without comparing the elements
+    template <typename U = V, typename = decltype(std::declval<const U&>() == std::declval<const U&>())>
+    bool operator==(const OrderedMap& other) const
+    {
+        if (m_size != other.m_size) return false;
+        if (m_root == other.m_root) return true;
+        auto i = other.begin();
+        for (auto e : *this)
+        {
+            auto o = *i;
+            if (Less{}(e.first, o.first) || Less{}(o.first, e.first) || !(e.second == o.second)) return false;
+            ++i;
+        }
+        return true;
+    }
+
+    template <typename U = V, typename = decltype(std::declval<const U&>() == std::declval<const U&>())>
+    bool operator!=(const OrderedMap& other) const { return !(*this == other); }
+
+    // keys and values are stored separately, so elements are pairs of references
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<K, V>;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::pair<const K&, const V&>;
+
+        struct pointer
+        {
+            reference ref;
+            const reference* operator->() const { return &ref; }
+        };
+
+        const_iterator() = default;
+
+        const K& key() const { return m_leaf->keys[m_index]; }
+        const V& value() const { return m_leaf->values[m_index]; }
+
+        reference operator*() const { return {key(), value()}; }
+        pointer operator->() const { return {**this}; }
+
+        const_iterator& operator++()
+        {
+            if (++m_index < m_leaf->size()) return *this;
+            nextLeaf();
+            return *this;
+        }
+        const_iterator operator++(int) { auto ret = *this; ++*this; return ret; }
+
+        bool operator==(const const_iterator& b) const { return m_leaf == b.m_leaf && m_index == b.m_index; }
+        bool operator!=(const const_iterator& b) const { return !(*this == b); }
+
+    private:
+        friend class OrderedMap;
+
+        // path[0] is the root, path[levels - 1] is the parent of the leaf
+        void descendFirst(const void* node, uint32_t level, uint32_t depth)
+        {
+            m_levels = depth + level;
+            for (; level; --level, ++depth)
+            {
+                auto& inner = static_cast<const typename Payload<Inner>::Block*>(node)->value;
+                m_path[depth] = &inner;
+                m_pathIndex[depth] = 0;
+                node = inner.children[0];
+            }
+            m_leaf = &static_cast<const typename Payload<Leaf>::Block*>(node)->value;
+            m_index = 0;
+        }
+
+        void nextLeaf()
+        {
+            for (auto d = m_levels; d--;)
+            {
+                auto& i = m_pathIndex[d];
+                if (i + 1 < m_path[d]->children.size())
+                {
+                    ++i;
+                    descendFirst(m_path[d]->children[i], m_path[d]->level - 1, d + 1);
+                    return;
+                }
+            }
+            m_leaf = nullptr;
+            m_index = 0;
+        }
+
+        // moves to the next element if the index is past the end of the leaf
+        void normalize()
+        {
+            if (m_index == m_leaf->size()) nextLeaf();
+        }
+
+        const Inner* m_path[impl::btree::Max_Levels];
+        uint32_t m_pathIndex[impl::btree::Max_Levels];
+        uint32_t m_levels = 0;
+        const Leaf* m_leaf = nullptr;
+        uint32_t m_index = 0;
+    };
+
+    // a builder for bulk edits
+    // the transient owns its map exclusively (it's move-only), so the nodes it clones stay unique to it
+    // and are edited in place from then on, the same as unique nodes in a transaction
+    // unlike the edits of a map, edits of missing keys may clone the path to where the key would be,
+    // which saves the extra lookup each of them needs to avoid that
+    class Transient
+    {
+    public:
+        explicit Transient(OrderedMap map) : m_map(std::move(map)) {}
+
+        Transient(const Transient&) = delete;
+        Transient& operator=(const Transient&) = delete;
+        Transient(Transient&&) noexcept = default;
+        Transient& operator=(Transient&&) noexcept = default;
+
+        size_t size() const { return m_map.size(); }
+        bool empty() const { return m_map.empty(); }
+        const V* find(const K& key) const { return m_map.find(key); }
+        bool contains(const K& key) const { return m_map.contains(key); }
+
+        bool set(K key, V value) { return m_map.set(std::move(key), std::move(value), true); }
+        bool insert(K key, V value) { return m_map.set(std::move(key), std::move(value), false); }
+
+        template <typename F>
+        bool update(const K& key, F f)
+        {
+            auto v = m_map.editableFind(key);
+            if (!v) return false;
+            f(*v);
+            return true;
+        }
+
+        bool erase(const K& key) { return m_map.eraseUnchecked(key); }
+
+        // the edited map (the transient is left empty)
+        OrderedMap persistent() { return std::move(m_map); }
+
+    private:
+        OrderedMap m_map;
+    };
+
+private:
+    template <typename A>
+    static uint32_t lowerBound(const A& keys, const K& key)
+    {
+        return uint32_t(std::lower_bound(keys.begin(), keys.end(), key, Less{}) - keys.begin());
+    }
+
+    template <typename A>
+    static uint32_t upperBound(const A& keys, const K& key)
+    {
+        return uint32_t(std::upper_bound(keys.begin(), keys.end(), key, Less{}) - keys.begin());
+    }
+
+    // inserts, and assigns if assign is true
+    bool set(K&& key, V&& value, bool assign)
+    {
+        if (!m_root) m_root = Payload<Leaf>::make().releaseBlock();
+
+        Split split;
+        const bool inserted = insert(m_root, m_levels, std::move(key), std::move(value), assign, split);
+        if (split.node)
+        {
+            // the root was split: add a level
+            auto root = Payload<Inner>::make(m_levels + 1);
+            root->keys.push_back(std::move(*split.key));
+            root->children.push_back(m_root);
+            root->children.push_back(split.node);
+            m_root = root.releaseBlock();
+            ++m_levels;
+        }
+        m_size += inserted;
+        return inserted;
+    }
+
+    // the tree over the leaves of a new map
+    void build(std::vector<Payload<Leaf>>& leaves)
+    {
+        std::vector<K> mins; // the smallest key of each node of the level
+        mins.reserve(leaves.size());
+        for (auto& l : leaves) mins.push_back(l->keys[0]);
+
+        if (leaves.size() == 1)
+        {
+            m_root = leaves.front().releaseBlock();
+            return;
+        }
+
+        auto level = group(leaves, mins, ++m_levels);
+        while (level.size() > 1) level = group(level, mins, ++m_levels);
+        m_root = level.front().releaseBlock();
+    }
+
+    // full inner nodes at level over the nodes of the level below
+    // the last two share their children if needed, so that both have at least Min keys
+    template <typename C>
+    static std::vector<Payload<Inner>> group(std::vector<Payload<C>>& nodes, std::vector<K>& mins, uint32_t level)
+    {
+        constexpr size_t Fanout = Max + 1;
+        std::vector<Payload<Inner>> ret;
+        std::vector<K> retMins;
+        ret.reserve((nodes.size() + Fanout - 1) / Fanout);
+        retMins.reserve(ret.capacity());
+        for (size_t i = 0; i < nodes.size();)
+        {
+            const auto rest = nodes.size() - i;
+            auto count = std::min(rest, Fanout);
+            if (rest > Fanout && rest <= Fanout + Min) count = rest - rest / 2;
+
+            auto node = Payload<Inner>::make(level);
+            for (auto j = i; j < i + count; ++j)
+            {
+                if (j != i) node->keys.push_back(std::move(mins[j]));
+                node->children.push_back(nodes[j].releaseBlock());
+            }
+            retMins.push_back(std::move(mins[i]));
+            ret.push_back(std::move(node));
+            i += count;
+        }
+        mins.swap(retMins);
+        return ret;
+    }
+
+    // clones the nodes on the path to key even if there is no such key
+    V* editableFind(const K& key)
+    {
+        if (!m_root) return nullptr;
+        auto n = &m_root;
+        for (auto l = m_levels; l; --l)
+        {
+            auto& inner = impl::btree::editable<Inner>(*n);
+            n = &inner.children[upperBound(inner.keys, key)];
+        }
+        auto& leaf = impl::btree::editable<Leaf>(*n);
+        const auto i = lowerBound(leaf.keys, key);
+        if (i == leaf.size() || Less{}(key, leaf.keys[i])) return nullptr;
+        return &leaf.values[i];
+    }
+
+    // clones the nodes on the path to key even if there is no such key
+    bool eraseUnchecked(const K& key)
+    {
+        if (!m_root || !erase(m_root, m_levels, key)) return false;
+        if (!--m_size) return clear(), true;
+
+        // remove root levels with a single child
+        while (m_levels && static_cast<typename Payload<Inner>::Block*>(m_root)->value.children.size() == 1)
+        {
+            auto child = static_cast<typename Payload<Inner>::Block*>(m_root)->value.children[0];
+            Inner::addRef(child, m_levels - 1);
+            Inner::release(m_root, m_levels);
+            m_root = child;
+            --m_levels;
+        }
+        return true;
+    }
+
+    const Leaf& leafFor(const K& key) const
+    {
+        const void* n = m_root;
+        for (auto l = m_levels; l; --l)
+        {
+            auto& inner = static_cast<const typename Payload<Inner>::Block*>(n)->value;
+            n = inner.children[upperBound(inner.keys, key)];
+        }
+        return static_cast<const typename Payload<Leaf>::Block*>(n)->value;
+    }
+
+    const_iterator bound(const K& key, bool upper) const
+    {
+        const_iterator ret;
+        if (!m_root) return ret;
+        const void* n = m_root;
+        ret.m_levels = m_levels;
+        for (uint32_t d = 0; d < m_levels; ++d)
+        {
+            auto& inner = static_cast<const typename Payload<Inner>::Block*>(n)->value;
+            const auto i = upperBound(inner.keys, key);
+            ret.m_path[d] = &inner;
+            ret.m_pathIndex[d] = i;
+            n = inner.children[i];
+        }
+        ret.m_leaf = &static_cast<const typename Payload<Leaf>::Block*>(n)->value;
+        ret.m_index = upper ? upperBound(ret.m_leaf->keys, key) : lowerBound(ret.m_leaf->keys, key);
+        ret.normalize();
+        return ret;
+    }
+
+    // the right half of a split node and the smallest key in it
+    struct Split
+    {
+        void* node = nullptr;
+        std::optional<K> key;
+    };
+
+    static bool insert(void*& n, uint32_t level, K&& key, V&& value, bool assign, Split& split)
+    {
+        if (!level)
+        {
+            auto& leaf = impl::btree::editable<Leaf>(n);
+            const auto i = lowerBound(leaf.keys, key);
+            if (i < leaf.size() && !Less{}(key, leaf.keys[i]))
+            {
+                if (assign) leaf.values[i] = std::move(value);
+                return false;
+            }
+            if (leaf.keys.full()) splitLeaf(leaf, i, std::move(key), std::move(value), split);
+            else
+            {
+                leaf.keys.insert(i, std::move(key));
+                leaf.values.insert(i, std::move(value));
+            }
+            return true;
+        }
+
+        auto& inner = impl::btree::editable<Inner>(n);
+        const auto ci = upperBound(inner.keys, key);
+        Split childSplit;
+        const bool inserted = insert(inner.children[ci], level - 1, std::move(key), std::move(value), assign, childSplit);
+        if (childSplit.node)
+        {
+            if (inner.keys.full()) splitInner(inner, ci, std::move(*childSplit.key), childSplit.node, split);
+            else
+            {
+                inner.keys.insert(ci, std::move(*childSplit.key));
+                inner.children.insert(ci + 1, childSplit.node);
+            }
+        }
+        return inserted;
+    }
+
+    // a full leaf with the new element at i, split in two halves
+    static void splitLeaf(Leaf& leaf, uint32_t i, K&& key, V&& value, Split& split)
+    {
+        std::vector<K> keys;
+        std::vector<V> values;
+        keys.reserve(Max + 1);
+        values.reserve(Max + 1);
+        for (uint32_t j = 0; j < leaf.size(); ++j)
+        {
+            if (j == i)
+            {
+                keys.push_back(std::move(key));
+                values.push_back(std::move(value));
+            }
+            keys.push_back(std::move(leaf.keys[j]));
+            values.push_back(std::move(leaf.values[j]));
+        }
+        if (i == leaf.size())
+        {
+            keys.push_back(std::move(key));
+            values.push_back(std::move(value));
+        }
+
+        leaf.keys.truncate(0);
+        leaf.values.truncate(0);
+        auto right = Payload<Leaf>::make();
+        const auto half = uint32_t(keys.size() / 2);
+        for (uint32_t j = 0; j < keys.size(); ++j)
+        {
+            auto& target = j < half ? leaf : *right;
+            target.keys.push_back(std::move(keys[j]));
+            target.values.push_back(std::move(values[j]));
+        }
+        split.key = right->keys[0];
+        split.node = right.releaseBlock();
+    }
+
+    // a full inner node with a new key at i and a new child at i + 1, split in two halves
+    // the middle key moves up to the parent
+    static void splitInner(Inner& inner, uint32_t i, K&& key, void* child, Split& split)
+    {
+        std::vector<K> keys;
+        std::vector<void*> children(inner.children.begin(), inner.children.end());
+        keys.reserve(Max + 1);
+        for (uint32_t j = 0; j < inner.size(); ++j)
+        {
+            if (j == i) keys.push_back(std::move(key));
+            keys.push_back(std::move(inner.keys[j]));
+        }
+        if (i == inner.size()) keys.push_back(std::move(key));
+        children.insert(children.begin() + i + 1, child);
+
+        // the children move, so there are no references to add or release
+        inner.keys.truncate(0);
+        inner.children.truncate(0);
+        auto right = Payload<Inner>::make(inner.level);
+        const auto half = uint32_t(keys.size() / 2);
+        for (uint32_t j = 0; j < half; ++j) inner.keys.push_back(std::move(keys[j]));
+        for (uint32_t j = half + 1; j < keys.size(); ++j) right->keys.push_back(std::move(keys[j]));
+        for (uint32_t j = 0; j <= half; ++j) inner.children.push_back(children[j]);
+        for (uint32_t j = half + 1; j < children.size(); ++j) right->children.push_back(children[j]);
+        split.key = std::move(keys[half]);
+        split.node = right.releaseBlock();
+    }
+
+    // returns false if there is no such key
+    // nodes may be left with fewer than Min keys, the parent fixes them
+    static bool erase(void*& n, uint32_t level, const K& key)
+    {
+        if (!level)
+        {
+            auto& leaf = impl::btree::editable<Leaf>(n);
+            const auto i = lowerBound(leaf.keys, key);
+            if (i == leaf.size() || Less{}(key, leaf.keys[i])) return false;
+            leaf.keys.erase(i);
+            leaf.values.erase(i);
+            return true;
+        }
+
+        auto& inner = impl::btree::editable<Inner>(n);
+        const auto ci = upperBound(inner.keys, key);
+        if (!erase(inner.children[ci], level - 1, key)) return false;
+        if (level == 1) rebalance<Leaf>(inner, ci);
+        else rebalance<Inner>(inner, ci);
+        return true;
+    }
+
+    // if the child at ci is too small, borrows from a sibling or merges with it
+    template <typename Child>
+    static void rebalance(Inner& parent, uint32_t ci)
+    {
+        auto size = [](void* c) { return static_cast<typename Payload<Child>::Block*>(c)->value.size(); };
+        if (size(parent.children[ci]) >= Min) return;
+
+        // the pair of siblings is (li, li + 1)
+        const auto li = ci ? ci - 1 : 0;
+        auto& left = impl::btree::editable<Child>(parent.children[li]);
+        auto& right = impl::btree::editable<Child>(parent.children[li + 1]);
+        auto& sep = parent.keys[li];
+
+        if constexpr (std::is_same_v<Child, Leaf>)
+        {
+            if (left.size() + right.size() <= Max)
+            {
+                for (uint32_t j = 0; j < right.size(); ++j)
+                {
+                    left.keys.push_back(std::move(right.keys[j]));
+                    left.values.push_back(std::move(right.values[j]));
+                }
+                Inner::release(parent.children[li + 1], 0);
+                parent.keys.erase(li);
+                parent.children.erase(li + 1);
+            }
+            else if (left.size() > right.size())
+            {
+                right.keys.insert(0, std::move(left.keys.back()));
+                right.values.insert(0, std::move(left.values.back()));
+                left.keys.pop_back();
+                left.values.pop_back();
+                sep = right.keys[0];
+            }
+            else
+            {
+                left.keys.push_back(std::move(right.keys[0]));
+                left.values.push_back(std::move(right.values[0]));
+                right.keys.erase(0);
+                right.values.erase(0);
+                sep = right.keys[0];
+            }
+        }
+        else
+        {
+            if (left.size() + 1 + right.size() <= Max)
+            {
+                left.keys.push_back(std::move(sep));
+                for (auto& k : right.keys) left.keys.push_back(std::move(k));
+                for (auto c : right.children) left.children.push_back(c);
+                right.children.truncate(0); // moved
+                Inner::release(parent.children[li + 1], right.level);
+                parent.keys.erase(li);
+                parent.children.erase(li + 1);
+            }
+            else if (left.size() > right.size())
+            {
+                right.keys.insert(0, std::move(sep));
+                sep = std::move(left.keys.back());
+                left.keys.pop_back();
+                right.children.insert(0, left.children.back());
+                left.children.pop_back();
+            }
+            else
+            {
+                left.keys.push_back(std::move(sep));
+                sep = std::move(right.keys[0]);
+                right.keys.erase(0);
+                left.children.push_back(right.children[0]);
+                right.children.erase(0);
+            }
+        }
+    }
+
+    void* m_root = nullptr; // a leaf if m_levels is zero
+    uint32_t m_levels = 0; // inner levels above the leaves
+    size_t m_size = 0;
+};
+
+} // namespace kuzco
@@ -0,0 +1,215 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Allocator.hpp"
+#include "impl/ReclaimQueue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace kuzco
+{
+
+namespace impl
+{
+// a single allocation holding a reference count and a value
+// unlike the shared_ptr control block there is no weak count and no deleter
+template <typename T>
+struct PayloadBlock
+{
+    template <typename... Args>
+    explicit PayloadBlock(Args&&... args)
+        : value(std::forward<Args>(args)...)
+    {}
+
+    void addRef() noexcept { refCount.fetch_add(1, std::memory_order_relaxed); }
+
+    // returns true if this was the last reference
+    bool releaseRef() noexcept { return refCount.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+
+    std::atomic_uint32_t refCount = 1;
+    uint32_t allocatorId = 0; // allocator which owns the memory of the block (zero for the global heap)
+    T value;
+};
+
+// allocates a block from the current allocator
+template <typename Block, typename... Args>
+Block* newBlock(Args&&... args)
+{
+    auto a = Allocator::current();
+    if (!a || !a->id()) return new Block(std::forward<Args>(args)...);
+
+    void* buf = a->allocate(sizeof(Block), alignof(Block));
+    Block* ret;
+    try
+    {
+        ret = new (buf) Block(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        a->deallocate(buf, sizeof(Block), alignof(Block));
+        throw;
+    }
+    a->addRef(); // every live allocation holds a reference to its allocator
+    ret->allocatorId = a->id();
+    return ret;
+}
+
+// returns a block to whichever allocator it came from
+template <typename Block>
+void deleteBlock(Block* b) noexcept
+{
+    if (!b->allocatorId)
+    {
+        delete b;
+        return;
+    }
+    auto a = Allocator::fromId(b->allocatorId);
+    b->~Block();
+    a->deallocate(b, sizeof(Block), alignof(Block));
+    a->release();
+}
+
+// destroys a block whose count reached zero
+// or hands it to the reclaimer if there is one
+template <typename Block>
+void disposeBlock(Block* b) noexcept
+{
+    if (ReclaimQueue::instance().push(b, [](void* p) { deleteBlock(static_cast<Block*>(p)); })) return;
+    deleteBlock(b);
+}
+} // namespace impl
+
+// intrusive reference counted pointer to a value
+// a replacement of std::shared_ptr for node payloads
+// the count lives in the same allocation as the value
+// Payload<const T> can be created from Payload<T> (they share the same block type)
+template <typename T>
+class Payload
+{
+public:
+    using Block = impl::PayloadBlock<std::remove_const_t<T>>;
+
+    Payload() noexcept = default;
+    Payload(std::nullptr_t) noexcept {}
+
+    Payload(const Payload& other) noexcept
+        : m_block(other.m_block)
+    {
+        if (m_block) m_block->addRef();
+    }
+
+    template <typename U, std::enable_if_t<std::is_same_v<const U, T>, int> = 0>
+    Payload(const Payload<U>& other) noexcept
+        : m_block(other.block())
+    {
+        if (m_block) m_block->addRef();
+    }
+
+    Payload(Payload&& other) noexcept
+        : m_block(other.m_block)
+    {
+        other.m_block = nullptr;
+    }
+
+    template <typename U, std::enable_if_t<std::is_same_v<const U, T>, int> = 0>
+    Payload(Payload<U>&& other) noexcept
+        : m_block(other.releaseBlock())
+    {}
+
+    Payload& operator=(const Payload& other) noexcept
+    {
+        Payload(other).swap(*this);
+        return *this;
+    }
+
+    Payload& operator=(Payload&& other) noexcept
+    {
+        Payload(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    Payload& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    ~Payload() { reset(); }
+
+    template <typename... Args>
+    static Payload make(Args&&... args)
+    {
+        return adopt(impl::newBlock<Block>(std::forward<Args>(args)...));
+    }
+
+    void reset() noexcept
+    {
+        if (m_block && m_block->releaseRef()) impl::disposeBlock(m_block);
+        m_block = nullptr;
+    }
+
+    void swap(Payload& other) noexcept { std::swap(m_block, other.m_block); }
+
+    T* get() const noexcept { return m_block ? &m_block->value : nullptr; }
+    T* operator->() const noexcept { return get(); }
+    T& operator*() const noexcept { return *get(); }
+
+    explicit operator bool() const noexcept { return !!m_block; }
+
+    uint32_t use_count() const noexcept { return m_block ? m_block->refCount.load(std::memory_order_acquire) : 0; }
+
+    // low level block access
+    // used when the count is managed externally (for example by atomic publication)
+    Block* block() const noexcept { return m_block; }
+
+    // take ownership of a block without touching its count
+    static Payload adopt(Block* block) noexcept
+    {
+        Payload ret;
+        ret.m_block = block;
+        return ret;
+    }
+
+    // give up ownership of the block without touching its count
+    Block* releaseBlock() noexcept
+    {
+        auto ret = m_block;
+        m_block = nullptr;
+        return ret;
+    }
+
+    template <typename U>
+    bool operator==(const Payload<U>& b) const noexcept { return get() == b.get(); }
+    template <typename U>
+    bool operator!=(const Payload<U>& b) const noexcept { return get() != b.get(); }
+    bool operator==(std::nullptr_t) const noexcept { return !m_block; }
+    bool operator!=(std::nullptr_t) const noexcept { return !!m_block; }
+
+private:
+    Block* m_block = nullptr;
+};
+
+namespace impl
+{
+// the value of p for editing, cloned first if p is shared
+// used by persistent containers: a node whose only owner is the container being edited can be edited in place
+template <typename T>
+T& editable(Payload<T>& p)
+{
+    if (p.use_count() != 1) p = Payload<T>::make(std::as_const(*p));
+    return *p;
+}
+} // namespace impl
+
+} // namespace kuzco
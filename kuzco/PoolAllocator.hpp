@@ -0,0 +1,121 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Allocator.hpp"
+
+#include <atomic>
+#include <new>
+#include <vector>
+
+namespace kuzco
+{
+
+// size-class pool allocator for payloads of a single root
+//
+// allocations are served from per size-class free lists carved from large slabs
+// only the transaction thread allocates, so the allocating side needs no synchronization
+// deallocations may come from any thread and are pushed onto a lock-free per-class list
+// which the allocating side takes over in one go when its own list runs out
+// (since the allocating side only ever takes the entire list, there is no ABA problem)
+//
+// requests larger than the biggest size class or with bigger alignment go to the global heap
+class PoolAllocator final : public Allocator
+{
+public:
+    static constexpr std::size_t Granularity = 16;
+    static constexpr std::size_t Num_Classes = 32; // up to 512 bytes
+    static constexpr std::size_t Max_Pooled_Size = Granularity * Num_Classes;
+
+    explicit PoolAllocator(std::size_t slabSize = 64 * 1024)
+        : m_slabSize(slabSize)
+    {}
+
+    ~PoolAllocator()
+    {
+        for (auto s : m_slabs) ::operator delete(s, std::align_val_t(Granularity));
+    }
+
+    void* allocate(std::size_t size, std::size_t alignment) override
+    {
+        if (size > Max_Pooled_Size || alignment > Granularity)
+        {
+            return ::operator new(size, std::align_val_t(alignment));
+        }
+
+        auto ci = classIndex(size);
+        auto& c = m_classes[ci];
+
+        if (!c.local)
+        {
+            // take over everything freed so far
+            c.local = c.remote.exchange(nullptr, std::memory_order_acquire);
+        }
+
+        if (c.local)
+        {
+            auto ret = c.local;
+            c.local = ret->next;
+            return ret;
+        }
+
+        return carve((ci + 1) * Granularity);
+    }
+
+    void deallocate(void* p, std::size_t size, std::size_t alignment) noexcept override
+    {
+        if (size > Max_Pooled_Size || alignment > Granularity)
+        {
+            ::operator delete(p, std::align_val_t(alignment));
+            return;
+        }
+
+        auto& c = m_classes[classIndex(size)];
+        auto f = static_cast<FreeBlock*>(p);
+        f->next = c.remote.load(std::memory_order_relaxed);
+        while (!c.remote.compare_exchange_weak(f->next, f, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    static std::size_t classIndex(std::size_t size) { return size ? (size - 1) / Granularity : 0; }
+
+    void* carve(std::size_t size)
+    {
+        if (m_slabEnd - m_slabPos < std::ptrdiff_t(size))
+        {
+            auto slab = static_cast<char*>(::operator new(m_slabSize, std::align_val_t(Granularity)));
+            m_slabs.push_back(slab);
+            m_slabPos = slab;
+            m_slabEnd = slab + m_slabSize;
+        }
+        auto ret = m_slabPos;
+        m_slabPos += size;
+        return ret;
+    }
+
+    // separate cache lines so frees of different sizes don't contend
+    struct alignas(64) SizeClass
+    {
+        FreeBlock* local = nullptr; // accessed by the allocating thread only
+        std::atomic<FreeBlock*> remote = nullptr;
+    };
+
+    SizeClass m_classes[Num_Classes];
+
+    const std::size_t m_slabSize;
+    char* m_slabPos = nullptr;
+    char* m_slabEnd = nullptr;
+    std::vector<char*> m_slabs;
+};
+
+} // namespace kuzco
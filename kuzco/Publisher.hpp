@@ -0,0 +1,216 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Node.hpp"
+#include "impl/AtomicPayload.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace kuzco
+{
+
+// notifies subscribers of published states of type T
+// meant to be a base of the class which publishes (it calls notifySubscribers after each publish)
+//
+// the subscriber list is copy-on-write: subscribing and unsubscribing build a new list,
+// notifying only loads the current one without locks
+// so a subscriber which was just removed may still get one last notification which was already underway
+//
+// subscribers get the published state and are called outside of the transaction lock, one notification at a time
+// no lock of the publisher is held while they're called either, so they may publish new states themselves
+// (those are delivered after the current notification completes, by the same thread)
+// with an executor they are called wherever the executor runs them
+// notifications are tagged with versions and stale ones are dropped: a subscriber never gets a state
+// older than one it has already seen (this also means intermediate states may be skipped)
+// subscribers must not throw
+template <typename T>
+class Publisher
+{
+public:
+    using Subscriber = std::function<void(const Detached<T>&)>;
+    using Executor = std::function<void(std::function<void()>)>;
+    using SubscriptionId = uint64_t;
+
+    Publisher() = default;
+    Publisher(const Publisher&) = delete;
+    Publisher& operator=(const Publisher&) = delete;
+
+    SubscriptionId subscribe(Subscriber s)
+    {
+        return add({}, std::move(s));
+    }
+
+    // subscribe to a part of the state
+    // select(const T&) returns a node of the state (or anything else comparable with !=)
+    // s is called only if the selected node differs from the one in the last delivered state
+    // (nodes are compared shallowly, so this costs one walk down the selected path per notification)
+    //
+    // for example: root.subscribe([](const State& s) -> auto& { return s.a->b; }, onBChanged);
+    template <typename Select>
+    SubscriptionId subscribe(Select select, Subscriber s)
+    {
+        auto changed = [select = std::move(select)](const T& a, const T& b) {
+            return select(a) != select(b);
+        };
+        return add(std::move(changed), std::move(s));
+    }
+
+    // returns false if there is no such subscription
+    bool unsubscribe(SubscriptionId id)
+    {
+        std::lock_guard l(m_editMutex);
+        auto list = copyList();
+        auto& subs = list.subscribers;
+        for (auto i = subs.begin(); i != subs.end(); ++i)
+        {
+            if (i->id != id) continue;
+            subs.erase(i);
+            m_list.store(Payload<const List>::make(std::move(list)));
+            return true;
+        }
+        return false;
+    }
+
+    // executor(task) must eventually call task()
+    // an empty executor means the subscribers are called by the thread which published the state
+    // notifications posted to the executor must be completed before the publisher is destroyed
+    void setExecutor(Executor executor)
+    {
+        std::lock_guard l(m_editMutex);
+        auto list = copyList();
+        list.executor = std::move(executor);
+        m_list.store(Payload<const List>::make(std::move(list)));
+    }
+
+protected:
+    // the state path subscriptions are compared against until the first notification
+    void setBaseline(Payload<const T> state)
+    {
+        std::lock_guard l(m_deliverMutex);
+        if (!m_last) m_last = std::move(state);
+    }
+
+    // version must increase with each publish
+    // state must be the state published with it or a newer one
+    void notifySubscribers(uint64_t version, Payload<const T> state)
+    {
+        auto list = m_list.load();
+        if (!list || list->subscribers.empty()) return;
+
+        if (list->executor)
+        {
+            // the local reference keeps the executor alive while it's being called
+            auto& executor = list->executor;
+            executor([this, version, state = std::move(state), list]() mutable {
+                deliver(version, std::move(state), std::move(list));
+            });
+        }
+        else
+        {
+            deliver(version, std::move(state), std::move(list));
+        }
+    }
+
+private:
+    struct Entry
+    {
+        SubscriptionId id;
+        std::function<bool(const T&, const T&)> changed; // empty for subscriptions to the whole state
+        Subscriber subscriber;
+    };
+
+    struct List
+    {
+        std::vector<Entry> subscribers;
+        Executor executor;
+    };
+
+    SubscriptionId add(std::function<bool(const T&, const T&)> changed, Subscriber s)
+    {
+        std::lock_guard l(m_editMutex);
+        auto id = ++m_lastId;
+        auto list = copyList();
+        list.subscribers.push_back({id, std::move(changed), std::move(s)});
+        m_list.store(Payload<const List>::make(std::move(list)));
+        return id;
+    }
+
+    // called with m_editMutex locked
+    List copyList() const
+    {
+        auto cur = m_list.load();
+        return cur ? *cur : List{};
+    }
+
+    // one thread delivers at a time, so a subscriber is never called concurrently with itself
+    // and can't see states going backwards
+    // subscribers are called without holding the lock: a notification which comes in the meantime
+    // (from another thread or from a subscriber publishing a new state itself) is left pending
+    // and the delivering thread delivers it after the current one (only the newest pending one is kept)
+    void deliver(uint64_t version, Payload<const T> state, Payload<const List> list) noexcept
+    {
+        {
+            std::lock_guard l(m_deliverMutex);
+            if (version <= m_latest) return; // a newer state was delivered already or is pending
+            m_latest = version;
+            m_pending = {std::move(state), std::move(list)};
+            if (m_delivering) return;
+            m_delivering = true;
+        }
+
+        Pending cur;
+        Payload<const T> last;
+        while (true)
+        {
+            {
+                std::lock_guard l(m_deliverMutex);
+                // the last delivered state is kept alive, so its nodes can't be confused with new ones at the same addresses
+                if (cur.state) m_last = std::move(cur.state);
+                if (!m_pending.state)
+                {
+                    m_delivering = false;
+                    return;
+                }
+                cur = std::move(m_pending);
+                m_pending = {};
+                last = m_last;
+            }
+
+            Detached<T> d(cur.state);
+            for (auto& s : cur.list->subscribers)
+            {
+                if (s.changed && last && !s.changed(*last, *cur.state)) continue;
+                s.subscriber(d);
+            }
+        }
+    }
+
+    impl::AtomicPayload<const List> m_list;
+
+    struct Pending
+    {
+        Payload<const T> state;
+        Payload<const List> list;
+    };
+
+    std::mutex m_deliverMutex;
+    uint64_t m_latest = 0; // version of the newest state delivered or pending
+    bool m_delivering = false;
+    Pending m_pending;
+    Payload<const T> m_last; // last delivered state
+
+    std::mutex m_editMutex;
+    SubscriptionId m_lastId = 0;
+};
+
+} // namespace kuzco
@@ -0,0 +1,67 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "impl/ReclaimQueue.hpp"
+
+#include <thread>
+#include <vector>
+
+namespace kuzco
+{
+
+// background reclamation of dead payloads
+// while an instance is alive, payloads whose last reference is dropped are not destroyed in place
+// but are queued and destroyed in batches on the reclaimer's thread (along with their whole subtree)
+// this takes the destruction of large trees away from writers (in the transaction lock) and readers
+//
+// there can be only one reclaimer at a time: constructing another one throws std::logic_error
+// on destruction it destroys what's left in the queue and stops
+class Reclaimer
+{
+public:
+    Reclaimer()
+    {
+        auto& q = impl::ReclaimQueue::instance();
+        q.enable();
+        try
+        {
+            m_thread = std::thread([&q] {
+                impl::ReclaimQueue::destroyInline() = true;
+                std::vector<impl::ReclaimQueue::Item> batch;
+                while (q.waitAndTake(batch))
+                {
+                    for (auto& i : batch) i.destroy(i.block);
+                    batch.clear();
+                }
+            });
+        }
+        catch (...)
+        {
+            q.disable();
+            q.detach();
+            throw;
+        }
+    }
+
+    ~Reclaimer()
+    {
+        auto& q = impl::ReclaimQueue::instance();
+        q.disable();
+        m_thread.join();
+        q.detach();
+    }
+
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator=(const Reclaimer&) = delete;
+
+private:
+    std::thread m_thread;
+};
+
+} // namespace kuzco
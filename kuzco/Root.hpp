@@ -8,7 +8,20 @@
 #pragma once
 
 #include "Node.hpp"
+#include "Allocator.hpp"
+#include "Journal.hpp"
+#include "impl/AtomicPayload.hpp"
+#include "impl/Epoch.hpp"
+#include "impl/Merge.hpp"
+#include "impl/ReclaimQueue.hpp"
+#include "impl/CommitSignal.hpp"
+#include "impl/TransactionLock.hpp"
 
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
 #include <mutex>
 
 namespace kuzco
@@ -18,16 +31,19 @@ template <typename T>
 class Root
 {
 public:
-    Root(Node<T>&& obj)
+    // if an allocator is provided, all payloads created in transactions of this root will come from it
+    Root(Node<T>&& obj, AllocatorRef allocator = {})
         : m_root(std::move(obj))
+        , m_allocator(std::move(allocator))
     {
-        m_detachedRoot = m_root.m_data.payload;
+        m_detachedRoot.store(m_root.m_data.payload());
     }
 
-    Root(const Node<T>& obj)
+    Root(const Node<T>& obj, AllocatorRef allocator = {})
+        : m_allocator(std::move(allocator))
     {
         m_root.attachTo(obj);
-        m_detachedRoot = m_root.m_data.payload;
+        m_detachedRoot.store(m_root.m_data.payload());
     }
 
     Root(const Root&) = delete;
@@ -35,44 +51,482 @@ public:
     Root(Root&&) = delete;
     Root& operator=(Root&&) = delete;
 
-    // returns a non-const pointer to the underlying data
-    T* beginTransaction()
+    // the root is not cloned here, but on the first write access through transactionData
+    // thus read-only and cancelled transactions don't allocate anything
+    void beginTransaction()
+    {
+        m_transactionLock.lock();
+        onTransactionBegin(true);
+    }
+
+    // begins a transaction only if no other one is in progress
+    bool tryBeginTransaction()
     {
-        m_transactionMutex.lock();
-        m_root.replaceWith(impl::Data<T>::construct(*m_root.m_data.qdata));
-        return m_root.m_data.qdata;
+        if (!m_transactionLock.try_lock()) return false;
+        onTransactionBegin(true);
+        return true;
     }
 
-    void endTransaction(bool store = true)
+#if KUZCO_HAS_COROUTINES
+    // co_await to begin a transaction without blocking the thread
+    // if another transaction is in progress, the coroutine is suspended and resumed through resumer
+    // once the transaction lock is handed to it
+    //
+    // the transaction is not bound to a thread: it can be ended on another one
+    // for the same reason it doesn't make the allocator of the root current for the thread
+    // (payloads come from the allocator current for the thread which creates them)
+    class BeginAwaitable
     {
+    public:
+        bool await_ready() { return m_lock.await_ready(); }
+        bool await_suspend(std::coroutine_handle<> h) { return m_lock.await_suspend(h); }
+        void await_resume()
+        {
+            m_lock.await_resume();
+            m_root.onTransactionBegin(false);
+        }
+
+    private:
+        friend class Root;
+        BeginAwaitable(Root& root, Resumer resumer)
+            : m_root(root)
+            , m_lock(root.m_transactionLock.lockAsync(std::move(resumer)))
+        {}
+        Root& m_root;
+        impl::TransactionLock::LockAwaitable m_lock;
+    };
+
+    BeginAwaitable beginTransactionAsync(Resumer resumer = {}) { return BeginAwaitable(*this, std::move(resumer)); }
+#endif
+
+    // returns a non-const pointer to the underlying data
+    // clones the root if this is the first write access in the transaction
+    T* transactionData() { return m_root.get(); }
+
+    // read-only access to the data in a transaction (never clones)
+    const T* transactionData() const { return m_root.get(); }
+
+    // returns whether a new root was published
+    // if nothing was written in the transaction, there is nothing to publish
+    bool endTransaction(bool store = true)
+    {
+        // the root is unique only if it was cloned in this transaction
+        const bool changed = m_root.unique();
+        const bool publish = store && changed;
+
+        // whether the journal was made current at the beginning (it's moved away when published)
+        const bool journaled = !!m_journal;
+
+        Payload<T> old;
+
         // update handle
-        if (store)
+        if (publish)
         {
             // detach
-            std::atomic_store_explicit(&m_detachedRoot, m_root.m_data.payload, std::memory_order_relaxed);
+            old = m_detachedRoot.exchange(m_root.m_data.payload());
+            auto version = m_version.fetch_add(1, std::memory_order_seq_cst) + 1;
+            if (m_journal)
+            {
+                m_journal->m_version = version;
+                m_journal->seal();
+                m_lastJournal.store(std::move(m_journal));
+            }
         }
-        else
+        else if (changed)
         {
             // abort transaction
-            m_root.m_data.payload = m_detachedRoot;
-            m_root.m_data.qdata = m_root.m_data.payload.get();
+            // the clones are destroyed here even if there is a reclaimer,
+            // so the allocator sees them freed before the transaction ends (and can reuse their memory)
+            impl::ReclaimQueue::InlineScope inlineDestroy;
+            m_root.m_data = impl::Data<T>(m_detachedRoot.load());
+        }
+        if (m_threadBound)
+        {
+            if (m_allocator) m_allocator->transactionEnd(publish);
+            Allocator::popCurrent(this);
+            if (journaled) Journal::popCurrent(this);
+        }
+        Payload<Journal> dropped = std::move(m_journal); // if not published, released outside of the lock
+        m_transactionLock.unlock();
+
+        if (publish) m_commitSignal.notify();
+
+        // the old root may still be accessed by epoch readers, so it's retired instead of released
+        // this happens outside of the lock, as it may end up destroying a big tree
+        retire(std::move(old));
+
+        return publish;
+    }
+
+    // a mutation of the state to be applied as part of a batch
+    struct Mutation
+    {
+        std::function<void(T&)> apply;
+        std::exception_ptr error; // set if apply has thrown
+    };
+
+    // applies a batch of mutations in the current transaction and ends it
+    // [begin, end) is a range of pointers to mutations
+    // a mutation which throws fails alone: the transaction is rolled back and the others are applied again
+    // (so mutations shouldn't have side effects outside of the state)
+    // returns whether a new root was published
+    template <typename It>
+    bool applyMutations(It begin, It end)
+    {
+        while (true)
+        {
+            auto i = begin;
+            try
+            {
+                for (; i != end; ++i)
+                {
+                    auto& m = **i;
+                    if (!m.error) m.apply(*transactionData());
+                }
+            }
+            catch (...)
+            {
+                (*i)->error = std::current_exception();
+                endTransaction(false);
+                beginTransaction();
+                continue;
+            }
+            return endTransaction(true);
         }
-        m_transactionMutex.unlock();
     }
 
     Detached<T> detach() const { return Detached(detachedPayload()); }
-    std::shared_ptr<const T> detachedPayload() const
+
+    // calls f with the current detached root
+    // the data is guaranteed to be alive until f returns, but f must not keep references to it
+    // (use detach if you need to keep the data)
+    // with epoch reads enabled this doesn't touch any reference counts, otherwise it's the same as detach
+    template <typename F>
+    decltype(auto) read(F&& f) const
     {
-        return std::atomic_load_explicit(&m_detachedRoot, std::memory_order_relaxed);
+        auto epochs = m_epochs.load(std::memory_order_seq_cst);
+        if (!epochs)
+        {
+            auto p = m_detachedRoot.load();
+            return std::forward<F>(f)(static_cast<const T&>(*p));
+        }
+        impl::EpochGuard g(*epochs);
+        return std::forward<F>(f)(static_cast<const T&>(*m_detachedRoot.peek()));
+    }
+
+    // makes read use epoch based reclamation for this root (it can't be disabled afterwards)
+    // reads then don't write to shared memory, which helps with many reader threads
+    // but replaced roots are kept alive until the readers which may be using them are done
+    // and each commit costs a scan of the slots of the threads which have read from this root
+    // readers don't release anything: a replaced root which was still read at the time of a commit
+    // is released by a later commit (or by releaseRetired)
+    void enableEpochReads()
+    {
+        std::lock_guard l(m_transactionLock);
+        if (m_epochs.load(std::memory_order_relaxed)) return;
+        m_epochDomain = std::make_unique<impl::EpochDomain>();
+        m_epochs.store(m_epochDomain.get(), std::memory_order_seq_cst);
     }
 
+    // releases the replaced roots which readers are done with
+    // for writers which go idle while replaced roots are still held back by epoch reads
+    void releaseRetired()
+    {
+        auto epochs = m_epochs.load(std::memory_order_seq_cst);
+        if (epochs) epochs->reclaim();
+    }
+
+    Payload<const T> detachedPayload() const
+    {
+        return m_detachedRoot.load();
+    }
+
+    // when enabled, each transaction records the nodes it replaces in a journal
+    // the journal of the last published transaction is available through lastJournal
+    // (check its version to match it with a detached root)
+    // only thread bound transactions are journaled, not async or optimistic ones
+    // if a thread has transactions of several roots in progress, edits are recorded in the journal
+    // of the one which began last
+    void setJournaling(bool enabled)
+    {
+        std::lock_guard l(m_transactionLock);
+        m_journaling = enabled;
+    }
+
+    Payload<const Journal> lastJournal() const { return m_lastJournal.load(); }
+
+    // number of roots published so far
+    // it's incremented after the root is published, so the detached root is at least as new as the version
+    uint64_t version() const { return m_version.load(std::memory_order_seq_cst); }
+
+    // blocks until version() >= v and returns the version
+    // waiters are woken only when a new root is published
+    uint64_t waitForVersion(uint64_t v)
+    {
+        uint64_t ret;
+        m_commitSignal.wait([&] { return (ret = version()) >= v; });
+        return ret;
+    }
+
+    // blocks until pred(const T&) is true for the detached root and returns it
+    // pred is checked once initially and then once per published root under an internal lock
+    // so it should be cheap and must not access the root in any other way
+    // (roots published in quick succession may be skipped: only the latest one is checked)
+    template <typename Pred>
+    Detached<T> waitUntil(Pred pred)
+    {
+        Payload<const T> ret;
+        m_commitSignal.wait([&] {
+            ret = detachedPayload();
+            return pred(*ret);
+        });
+        return Detached<T>(std::move(ret));
+    }
+
+#if KUZCO_HAS_COROUTINES
+    // co_await versions of waitForVersion and waitUntil
+    // the coroutine is resumed through resumer by the thread which published the root
+    class VersionAwaitable : private impl::CommitSignal::AsyncWaiter
+    {
+    public:
+        bool await_ready() { return ready(); }
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            this->handle = h;
+            return m_root.m_commitSignal.suspend(this);
+        }
+        uint64_t await_resume() { return m_result; }
+
+    private:
+        friend class Root;
+        VersionAwaitable(Root& root, uint64_t v, Resumer resumer)
+            : m_root(root)
+            , m_version(v)
+        {
+            this->resumer = std::move(resumer);
+        }
+        bool ready() override { return (m_result = m_root.version()) >= m_version; }
+        Root& m_root;
+        uint64_t m_version;
+        uint64_t m_result = 0;
+    };
+
+    VersionAwaitable waitForVersionAsync(uint64_t v, Resumer resumer = {})
+    {
+        return VersionAwaitable(*this, v, std::move(resumer));
+    }
+
+    template <typename Pred>
+    class PredicateAwaitable : private impl::CommitSignal::AsyncWaiter
+    {
+    public:
+        bool await_ready() { return ready(); }
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            this->handle = h;
+            return m_root.m_commitSignal.suspend(this);
+        }
+        Detached<T> await_resume() { return Detached<T>(std::move(m_result)); }
+
+    private:
+        friend class Root;
+        PredicateAwaitable(Root& root, Pred pred, Resumer resumer)
+            : m_root(root)
+            , m_pred(std::move(pred))
+        {
+            this->resumer = std::move(resumer);
+        }
+        bool ready() override
+        {
+            m_result = m_root.detachedPayload();
+            return m_pred(*m_result);
+        }
+        Root& m_root;
+        Pred m_pred;
+        Payload<const T> m_result;
+    };
+
+    template <typename Pred>
+    PredicateAwaitable<Pred> waitUntilAsync(Pred pred, Resumer resumer = {})
+    {
+        return PredicateAwaitable<Pred>(*this, std::move(pred), std::move(resumer));
+    }
+#endif
+
+    // publishes desired as the new root if the current one is still expected
+    // desired is meant to be built from expected by the caller, without holding any locks
+    // the lock is held only for the check and the pointer swap
+    // returns false if another root was stored since expected was detached
+    // on success desired is moved from (the published root must not be edited)
+    bool compareAndPublish(const Detached<T>& expected, Node<T>&& desired)
+    {
+        if (!tryPublish(expected.get(), desired.m_data.payload())) return false;
+        Node<T> published(std::move(desired));
+        return true;
+    }
+
+    // calls f(T&) on a copy of the current root and publishes the result
+    // if another root was stored in the meantime, f is called again with it
+    // (there's no merge: any concurrent publish means a retry)
+    // so f shouldn't have side effects outside of the state
+    template <typename F>
+    void update(F f)
+    {
+        while (true)
+        {
+            auto base = m_detachedRoot.load();
+            Node<T> desired(std::as_const(*base));
+            f(*desired);
+            if (tryPublish(base.get(), desired.m_data.payload())) return;
+        }
+    }
+
+    // optimistic transaction
+    // the work is done on a private copy of the root, without holding the transaction lock
+    // so writers of different optimistic transactions don't wait for each other
+    // commit publishes the result (the lock is held only for a check and the pointer swap)
+    // if other roots were stored since the transaction began, it's merged with the current one first:
+    // changes to disjoint subtrees and fields are combined (see impl::Merger)
+    // it's a conflict if both changed the same value, or a part of a type without kuzcoFields
+    // in case of a conflict the work must be redone after restart
+    //
+    // payloads created in optimistic transactions come from the allocator current for the thread
+    // not the one of the root (allocators are only used by a single thread at a time)
+    class OptimisticTransaction
+    {
+    public:
+        explicit OptimisticTransaction(Root& root)
+            : m_root(root)
+        {
+            restart();
+        }
+
+        OptimisticTransaction(const OptimisticTransaction&) = delete;
+        OptimisticTransaction& operator=(const OptimisticTransaction&) = delete;
+
+        // drop all changes and begin anew from the current root
+        void restart()
+        {
+            m_base = m_root.m_detachedRoot.load();
+            m_node.m_data = impl::Data<T>(m_base);
+            m_node.setUnique(false); // cloned on first write
+        }
+
+        // returns false if there was a conflict and nothing was stored
+        // read-only transactions always succeed
+        // after a successful commit the transaction continues from the published root
+        // (which is immutable from then on, so the next write clones it)
+        bool commit()
+        {
+            if (!m_node.unique()) return true;
+            auto result = m_node.m_data.payload();
+            if (!m_root.mergeAndPublish(m_base, result)) return false;
+            m_base = std::move(result);
+            m_node.m_data = impl::Data<T>(m_base);
+            m_node.setUnique(false);
+            return true;
+        }
+
+        const T* get() const { return m_node.get(); }
+        const T* operator->() const { return get(); }
+        const T& operator*() const { return *get(); }
+
+        // clones the root on first use
+        T* get() { return m_node.get(); }
+        T* operator->() { return get(); }
+        T& operator*() { return *get(); }
+
+    private:
+        Root& m_root;
+        Payload<T> m_base; // the root the transaction started from
+        OptNode<T> m_node;
+    };
+
 private:
-    using PL = typename impl::Data<T>::Payload;
+    using PL = impl::AtomicPayload<T>;
+
+    // thread bound transactions make the allocator of the root current for the thread until they end
+    void onTransactionBegin(bool threadBound)
+    {
+        m_threadBound = threadBound;
+        if (threadBound)
+        {
+            if (m_journaling)
+            {
+                m_journal = Payload<Journal>::make();
+                Journal::pushCurrent(this, m_journal.get());
+            }
+            Allocator::pushCurrent(this, m_allocator.get());
+            if (m_allocator) m_allocator->transactionBegin();
+        }
+        m_root.setUnique(false); // the root is shared with the detached one until cloned
+    }
+
+    // releases a replaced root, or leaves it to the epoch domain if readers may be using it
+    void retire(Payload<T> p)
+    {
+        if (!p) return;
+        auto epochs = m_epochs.load(std::memory_order_seq_cst);
+        if (!epochs) return; // released here
+        epochs->retire(p.releaseBlock(), [](void* block) {
+            Payload<T>::adopt(static_cast<typename Payload<T>::Block*>(block)).reset();
+        });
+    }
+
+    // publishes a root built outside of a transaction if the current one is still base
+    bool tryPublish(const T* base, Payload<T> result)
+    {
+        Payload<T> old;
+        {
+            std::lock_guard l(m_transactionLock);
+            if (m_root.m_data.get() != base) return false;
+            m_root.m_data = impl::Data<T>(result);
+            old = m_detachedRoot.exchange(std::move(result));
+            m_version.fetch_add(1, std::memory_order_seq_cst);
+        }
+        m_commitSignal.notify();
+        retire(std::move(old));
+        return true;
+    }
+
+    // publishes ours if the current root is still base
+    // otherwise merges it with the current root and publishes the result
+    // the merge is done without holding the lock and is redone if yet another root was stored in the meantime
+    // on success ours is set to the published root
+    bool mergeAndPublish(const Payload<T>& base, Payload<T>& ours)
+    {
+        if (tryPublish(base.get(), ours)) return true;
+        while (true)
+        {
+            auto theirs = m_detachedRoot.load();
+            Payload<T> merged;
+            if (!impl::Merger::object(base, ours, theirs, merged)) return false;
+            if (tryPublish(theirs.get(), merged))
+            {
+                ours = std::move(merged);
+                return true;
+            }
+        }
+    }
 
     OptNode<T> m_root;
 
-    std::mutex m_transactionMutex;
+    AllocatorRef m_allocator;
+    bool m_threadBound = false; // whether the current transaction uses m_allocator
+
+    impl::TransactionLock m_transactionLock; // not bound to a thread, so transactions can be awaited
     PL m_detachedRoot; // transaction safe root, atomically updated only after transaction ends
+
+    // null unless epoch reads are enabled
+    std::unique_ptr<impl::EpochDomain> m_epochDomain;
+    std::atomic<impl::EpochDomain*> m_epochs = nullptr;
+
+    std::atomic_uint64_t m_version = 0;
+
+    bool m_journaling = false;
+    Payload<Journal> m_journal; // of the transaction in progress
+    impl::AtomicPayload<const Journal> m_lastJournal;
+    impl::CommitSignal m_commitSignal; // for waitForVersion and waitUntil
 };
 
 }
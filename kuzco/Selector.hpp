@@ -0,0 +1,120 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Node.hpp"
+#include "impl/AtomicPayload.hpp"
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace kuzco
+{
+
+namespace impl
+{
+// selector inputs: detached nodes and payloads of immutable data
+// nodes are not accepted: the data of a unique node can be edited in place,
+// so the same payload could have different values and the cache would return stale results
+template <typename H>
+struct IsSelectorInput : std::false_type {};
+template <typename T>
+struct IsSelectorInput<Detached<T>> : std::true_type {};
+template <typename T>
+struct IsSelectorInput<Payload<const T>> : std::true_type {};
+
+template <typename T>
+const T* selectorData(const Detached<T>& d)
+{
+    static_assert(!IsInlineLeaf<T>, "inline leaves have no identity to cache by (and are cheap to read)");
+    return d.get();
+}
+template <typename T>
+const T* selectorData(const Payload<const T>& p) { return p.get(); }
+
+template <typename T>
+Payload<const T> selectorPayload(const Detached<T>& d) { return d.payload(); }
+template <typename T>
+Payload<const T> selectorPayload(const Payload<const T>& p) { return p; }
+} // namespace impl
+
+// a value derived from parts of the state with f(const In&...)
+// it's cached and recomputed only when one of the inputs is a different payload than the last time
+// (since subtrees are shared between snapshots, unchanged inputs are the same payloads)
+//
+// inputs are detached nodes of published states or immutable payloads (such as the results of other selectors)
+// thus selectors can be composed: total(items) and count(items) can be the inputs of average
+// (see also compose)
+// nodes can't be inputs, since in a transaction they may be edited in place: use sel(state->items.detach())
+// (which is also why a node detached in a transaction must not be edited until the selector is done with it)
+//
+// the cache is shared and thread safe: a selector can be called from multiple threads
+// if several threads miss the cache at the same time, each computes the value and the last one is cached
+// the cache keeps the last inputs alive, so a new payload can't be confused with an old one at the same address
+template <typename F, typename... In>
+class Selector
+{
+    static_assert(sizeof...(In) > 0, "a selector needs inputs");
+public:
+    using Result = std::decay_t<std::invoke_result_t<const F&, const In&...>>;
+
+    explicit Selector(F f) : m_f(std::move(f)) {}
+
+    Selector(const Selector&) = delete;
+    Selector& operator=(const Selector&) = delete;
+
+    template <typename... H>
+    Payload<const Result> operator()(const H&... in) const
+    {
+        static_assert(sizeof...(H) == sizeof...(In), "wrong number of inputs");
+        static_assert((impl::IsSelectorInput<H>::value && ...), "selector inputs must be Detached<T> or Payload<const T> (use node.detach())");
+        const std::tuple<const In*...> data(impl::selectorData(in)...);
+
+        auto cached = m_cache.load();
+        if (cached && sameInputs(*cached, data, std::index_sequence_for<In...>{})) return cached->result;
+
+        auto result = Payload<const Result>(Payload<Result>::make(m_f(*impl::selectorData(in)...)));
+        m_cache.store(Payload<const Entry>(Payload<Entry>::make(Entry{{impl::selectorPayload(in)...}, result})));
+        return result;
+    }
+
+    // drop the cached value and inputs
+    void reset() { m_cache.store({}); }
+
+private:
+    struct Entry
+    {
+        std::tuple<Payload<const In>...> inputs;
+        Payload<const Result> result;
+    };
+
+    template <size_t... I>
+    static bool sameInputs(const Entry& e, const std::tuple<const In*...>& data, std::index_sequence<I...>)
+    {
+        return ((std::get<I>(e.inputs).get() == std::get<I>(data)) && ...);
+    }
+
+    F m_f;
+    mutable impl::AtomicPayload<const Entry> m_cache;
+};
+
+// auto total = kuzco::select<Items>([](const Items& items) { ... });
+template <typename... In, typename F>
+Selector<F, In...> select(F f) { return Selector<F, In...>(std::move(f)); }
+
+// compose(outer, inner...)(in...) is outer(inner(in)...)
+// with selectors as inner functions, outer is recomputed only if one of their results is recomputed
+// the functions are referenced, so they must outlive the result
+template <typename Outer, typename... Inner>
+auto compose(const Outer& outer, const Inner&... inner)
+{
+    return [&outer, &inner...](const auto&... in) { return outer(inner(in)...); };
+}
+
+} // namespace kuzco
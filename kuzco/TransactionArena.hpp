@@ -0,0 +1,153 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Allocator.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+namespace kuzco
+{
+
+// bump allocator for payloads of a single root
+//
+// payloads are carved sequentially from aligned chunks
+// each chunk counts its live payloads and is returned to the global heap when the count reaches zero
+// so nodes which survive a commit are simply kept in place (no promotion copy is needed)
+//
+// when a transaction is aborted, the clones it made are destroyed by the root
+// (they hold references to shared children, so their destructors must run)
+// but their memory is not freed one by one: if all of them are dead, the bump position
+// of the current chunk is rewound to where it was when the transaction began
+// (the root destroys them on the transaction thread even when a Reclaimer is running, so they're counted)
+class TransactionArena final : public Allocator
+{
+public:
+    static constexpr std::size_t Chunk_Size = 64 * 1024;
+    static constexpr std::size_t Granularity = 16;
+    static constexpr std::size_t Max_Arena_Size = Chunk_Size / 8;
+
+    TransactionArena() = default;
+
+    ~TransactionArena()
+    {
+        if (m_chunk) releaseChunk(m_chunk);
+    }
+
+    void* allocate(std::size_t size, std::size_t alignment) override
+    {
+        if (size > Max_Arena_Size || alignment > Granularity)
+        {
+            return ::operator new(size, std::align_val_t(alignment));
+        }
+
+        size = (size + Granularity - 1) & ~(Granularity - 1);
+        if (!m_chunk || m_pos + size > m_chunk->end())
+        {
+            newChunk();
+        }
+
+        auto ret = m_pos;
+        m_pos += size;
+        m_chunk->live.fetch_add(1, std::memory_order_relaxed);
+        ++m_txnAllocs;
+        return ret;
+    }
+
+    void deallocate(void* p, std::size_t size, std::size_t alignment) noexcept override
+    {
+        if (size > Max_Arena_Size || alignment > Granularity)
+        {
+            ::operator delete(p, std::align_val_t(alignment));
+            return;
+        }
+
+        auto chunk = Chunk::of(p);
+
+        // frees of clones made by the current transaction happen on the transaction thread
+        // (an aborting root destroys them inline, bypassing the reclaimer)
+        // the only exception would be a clone detached and released by another thread mid-transaction,
+        // but then it's not dead at the end of the transaction and the rewind doesn't happen anyway
+        if (current() == this && m_inTransaction && chunk == m_chunk && static_cast<char*>(p) >= m_mark)
+        {
+            ++m_txnFrees;
+        }
+
+        releaseChunk(chunk);
+    }
+
+    void transactionBegin() override
+    {
+        m_inTransaction = true;
+        m_mark = m_pos;
+        m_txnAllocs = 0;
+        m_txnFrees = 0;
+    }
+
+    void transactionEnd(bool stored) override
+    {
+        if (!stored && m_chunk && m_txnAllocs == m_txnFrees)
+        {
+            // everything allocated since the mark is dead
+            m_pos = m_mark;
+        }
+        m_inTransaction = false;
+    }
+
+private:
+    struct alignas(64) Chunk
+    {
+        // the chunk which is currently used for allocations holds an extra reference
+        std::atomic_uint32_t live = 1;
+
+        char* begin() { return reinterpret_cast<char*>(this) + sizeof(Chunk); }
+        char* end() { return reinterpret_cast<char*>(this) + Chunk_Size; }
+
+        static Chunk* of(void* p)
+        {
+            return reinterpret_cast<Chunk*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(Chunk_Size - 1));
+        }
+    };
+
+    static void releaseChunk(Chunk* c) noexcept
+    {
+        if (c->live.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            c->~Chunk();
+            ::operator delete(c, std::align_val_t(Chunk_Size));
+        }
+    }
+
+    void newChunk()
+    {
+        auto buf = ::operator new(Chunk_Size, std::align_val_t(Chunk_Size));
+        auto old = m_chunk;
+        m_chunk = new (buf) Chunk;
+        m_pos = m_chunk->begin();
+
+        // allocations of the transaction in the old chunk will be freed with it
+        m_mark = m_pos;
+        m_txnAllocs = 0;
+        m_txnFrees = 0;
+
+        if (old) releaseChunk(old);
+    }
+
+    // all of these are only accessed by the transaction thread
+    Chunk* m_chunk = nullptr;
+    char* m_pos = nullptr;
+
+    bool m_inTransaction = false;
+    char* m_mark = nullptr; // bump position at the beginning of the transaction
+    std::size_t m_txnAllocs = 0; // allocations in the current chunk since the mark
+    std::size_t m_txnFrees = 0; // deallocations of the above
+};
+
+} // namespace kuzco
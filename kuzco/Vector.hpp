@@ -0,0 +1,541 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Payload.hpp"
+#include "impl/FixedArray.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace kuzco
+{
+
+namespace impl
+{
+namespace vec
+{
+constexpr uint32_t Bits = 5;
+constexpr uint32_t Width = 1 << Bits;
+constexpr size_t Mask = Width - 1;
+
+template <typename T>
+using Leaf = FixedArray<T, Width>;
+
+// an inner node of the trie
+// children are payload blocks of inner nodes or of leaves (if shift is Bits)
+// the block type is known from the shift, so they're stored as untyped pointers
+// children entirely before the offset of the vector are released and null
+template <typename T>
+struct Inner
+{
+    using InnerBlock = typename Payload<Inner>::Block;
+    using LeafBlock = typename Payload<Leaf<T>>::Block;
+
+    explicit Inner(uint32_t s) : shift(s) {}
+
+    Inner(const Inner& other)
+        : shift(other.shift)
+        , count(other.count)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            children[i] = other.children[i];
+            if (!children[i]) continue;
+            if (shift == Bits) static_cast<LeafBlock*>(children[i])->addRef();
+            else static_cast<InnerBlock*>(children[i])->addRef();
+        }
+    }
+
+    Inner& operator=(const Inner&) = delete;
+
+    ~Inner()
+    {
+        while (count) releaseBack();
+    }
+
+    void releaseBack() { release(--count); }
+
+    void release(uint32_t i)
+    {
+        auto c = children[i];
+        if (!c) return;
+        children[i] = nullptr;
+        if (shift == Bits) Payload<Leaf<T>>::adopt(static_cast<LeafBlock*>(c)).reset();
+        else Payload<Inner>::adopt(static_cast<InnerBlock*>(c)).reset();
+    }
+
+    const Inner& inner(uint32_t i) const { return static_cast<InnerBlock*>(children[i])->value; }
+    const Leaf<T>& leaf(uint32_t i) const { return static_cast<LeafBlock*>(children[i])->value; }
+
+    uint32_t shift;
+    uint32_t count = 0;
+    void* children[Width];
+};
+
+// impl::editable for a child of an inner node
+template <typename X>
+X& editable(void*& child)
+{
+    auto p = Payload<X>::adopt(static_cast<typename Payload<X>::Block*>(child));
+    auto& ret = impl::editable(p);
+    child = p.releaseBlock();
+    return ret;
+}
+} // namespace vec
+} // namespace impl
+
+// persistent vector
+// a radix balanced trie with a branching factor of 32 and a tail (the last leaf held separately)
+// copies are O(1) and share everything
+// index, set, push_back, pop_back and slice are O(log32 n), push_back and pop_back are O(1) most of the time
+//
+// nodes follow the same rules as nodes of the state:
+// a node is edited in place if the vector is its only owner, otherwise it's cloned first
+// so the first edit of a vector cloned in a transaction clones only the path to the edited element
+// and subsequent edits of the same part are in place
+// nodes are payloads, so they come from the current allocator
+//
+// dropping from the front moves an offset
+// the leaves entirely before it are released (when it crosses into a new leaf, which costs O(log32 n))
+// and the trie is lowered and rebased as the offset moves on, so a vector used as a queue doesn't grow
+// (the elements before the offset in its leaf are kept alive until the whole leaf is dropped)
+template <typename T>
+class Vector
+{
+    using Leaf = impl::vec::Leaf<T>;
+    using Inner = impl::vec::Inner<T>;
+    static constexpr uint32_t Bits = impl::vec::Bits;
+    static constexpr size_t Mask = impl::vec::Mask;
+public:
+    using value_type = T;
+    using size_type = size_t;
+
+    class const_iterator;
+
+    Vector() = default;
+
+    Vector(std::initializer_list<T> list)
+        : Vector(list.begin(), list.end())
+    {}
+
+    // O(n): the leaves are filled one after another and the trie is built over them bottom up
+    template <typename It, typename = typename std::iterator_traits<It>::iterator_category>
+    Vector(It first, It last)
+    {
+        std::vector<Payload<Leaf>> leaves;
+        for (; first != last; ++first)
+        {
+            if (!m_tail || m_tail->full())
+            {
+                if (m_tail) leaves.push_back(std::move(m_tail));
+                m_tail = Payload<Leaf>::make();
+            }
+            m_tail->push_back(*first);
+            ++m_size;
+        }
+        buildTrie(leaves);
+    }
+
+    Vector(const Vector&) = default;
+    Vector& operator=(const Vector&) = default;
+
+    Vector(Vector&& other) noexcept { swap(other); }
+    Vector& operator=(Vector&& other) noexcept
+    {
+        Vector(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void swap(Vector& other) noexcept
+    {
+        m_root.swap(other.m_root);
+        m_tail.swap(other.m_tail);
+        std::swap(m_shift, other.m_shift);
+        std::swap(m_offset, other.m_offset);
+        std::swap(m_size, other.m_size);
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+
+    const T& operator[](size_t i) const
+    {
+        auto j = i + m_offset;
+        return leafAt(j)[j & Mask];
+    }
+
+    const T& at(size_t i) const
+    {
+        if (i >= m_size) throw std::out_of_range("kuzco::Vector::at");
+        return (*this)[i];
+    }
+
+    const T& front() const { return (*this)[0]; }
+    const T& back() const { return (*this)[m_size - 1]; }
+
+    void set(size_t i, T value)
+    {
+        update(i, [&](T& e) { e = std::move(value); });
+    }
+
+    // calls f(T&) with the element at i, cloning the nodes on the path to it if they are shared
+    template <typename F>
+    void update(size_t i, F f)
+    {
+        f(editableAt(i + m_offset));
+    }
+
+    void push_back(T value)
+    {
+        const auto total = end_index();
+        if (!m_tail)
+        {
+            m_tail = Payload<Leaf>::make();
+        }
+        else if (m_tail->full())
+        {
+            pushTail(tailOffset(total));
+            m_tail = Payload<Leaf>::make();
+        }
+        impl::editable(m_tail).push_back(std::move(value));
+        ++m_size;
+    }
+
+    void pop_back()
+    {
+        if (m_size == 1) return clear();
+        if (m_tail->size() > 1)
+        {
+            impl::editable(m_tail).pop_back();
+        }
+        else
+        {
+            m_tail = popTail();
+        }
+        --m_size;
+
+        // the new tail may be the leaf with the first element
+        const auto tailStart = tailOffset(end_index());
+        if (m_root && m_offset >= tailStart) rebaseToTail(tailStart);
+    }
+
+    void clear() noexcept
+    {
+        m_root.reset();
+        m_tail.reset();
+        m_shift = Bits;
+        m_offset = 0;
+        m_size = 0;
+    }
+
+    // keep the first n elements
+    void take(size_t n)
+    {
+        if (n >= m_size) return;
+        if (n == 0) return clear();
+
+        const auto total = m_offset + n;
+        const auto newTailOffset = tailOffset(total);
+        const auto tailSize = uint32_t(total - newTailOffset);
+        if (newTailOffset != tailOffset(end_index()))
+        {
+            // the new tail is in the trie
+            m_tail = leafPayloadAt(newTailOffset);
+            if (newTailOffset <= m_offset) rebaseToTail(newTailOffset); // it's the leaf with the first element
+            else trimTrie(newTailOffset);
+        }
+        if (m_tail->size() != tailSize) impl::editable(m_tail).truncate(tailSize);
+        m_size = n;
+    }
+
+    // remove the first n elements
+    void drop(size_t n)
+    {
+        if (n >= m_size) return clear();
+        const auto prev = m_offset;
+        m_offset += n;
+        m_size -= n;
+        if ((prev & ~Mask) != (m_offset & ~Mask)) trimFront();
+    }
+
+    // the elements in [begin, end)
+    Vector slice(size_t begin, size_t end) const
+    {
+        Vector ret = *this;
+        ret.take(end);
+        ret.drop(begin);
+        return ret;
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_size); }
+
+    // vectors which share all their nodes are equal without comparing the elements
+    template <typename U = T, typename = decltype(std::declval<const U&>() == std::declval<const U&>())>
+    bool operator==(const Vector& other) const
+    {
+        if (m_size != other.m_size) return false;
+        if (m_root == other.m_root && m_tail == other.m_tail && m_offset == other.m_offset) return true;
+        auto i = other.begin();
+        for (auto& e : *this)
+        {
+            if (!(e == *i)) return false;
+            ++i;
+        }
+        return true;
+    }
+
+    template <typename U = T, typename = decltype(std::declval<const U&>() == std::declval<const U&>())>
+    bool operator!=(const Vector& other) const { return !(*this == other); }
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+
+        reference operator*() const
+        {
+            const auto j = m_index + m_vec->m_offset;
+            if (!m_leaf || (j & ~Mask) != m_leafStart)
+            {
+                // the leaf is cached, so iterating costs O(1) per element
+                m_leafStart = j & ~Mask;
+                m_leaf = m_vec->leafAt(j).data();
+            }
+            return m_leaf[j & Mask];
+        }
+        pointer operator->() const { return &**this; }
+        reference operator[](difference_type n) const { return *(*this + n); }
+
+        const_iterator& operator++() { ++m_index; return *this; }
+        const_iterator operator++(int) { auto ret = *this; ++m_index; return ret; }
+        const_iterator& operator--() { --m_index; return *this; }
+        const_iterator operator--(int) { auto ret = *this; --m_index; return ret; }
+        const_iterator& operator+=(difference_type n) { m_index += n; return *this; }
+        const_iterator& operator-=(difference_type n) { m_index -= n; return *this; }
+        friend const_iterator operator+(const_iterator i, difference_type n) { return i += n; }
+        friend const_iterator operator+(difference_type n, const_iterator i) { return i += n; }
+        friend const_iterator operator-(const_iterator i, difference_type n) { return i -= n; }
+        friend difference_type operator-(const const_iterator& a, const const_iterator& b) { return difference_type(a.m_index) - difference_type(b.m_index); }
+
+        bool operator==(const const_iterator& b) const { return m_index == b.m_index; }
+        bool operator!=(const const_iterator& b) const { return m_index != b.m_index; }
+        bool operator<(const const_iterator& b) const { return m_index < b.m_index; }
+        bool operator>(const const_iterator& b) const { return m_index > b.m_index; }
+        bool operator<=(const const_iterator& b) const { return m_index <= b.m_index; }
+        bool operator>=(const const_iterator& b) const { return m_index >= b.m_index; }
+
+    private:
+        friend class Vector;
+        const_iterator(const Vector* v, size_t i) : m_vec(v), m_index(i) {}
+
+        const Vector* m_vec = nullptr;
+        size_t m_index = 0;
+        mutable const T* m_leaf = nullptr;
+        mutable size_t m_leafStart = 0;
+    };
+
+private:
+    // indices below are of the trie space: they include the offset
+    size_t end_index() const { return m_offset + m_size; }
+
+    // the index of the first element of the tail for a given end index
+    static size_t tailOffset(size_t total) { return total ? (total - 1) & ~Mask : 0; }
+
+    const Leaf& leafAt(size_t j) const
+    {
+        if (j >= tailOffset(end_index())) return *m_tail;
+        const Inner* node = m_root.get();
+        for (auto s = m_shift; s > Bits; s -= Bits) node = &node->inner((j >> s) & Mask);
+        return node->leaf((j >> Bits) & Mask);
+    }
+
+    Payload<Leaf> leafPayloadAt(size_t j) const
+    {
+        const Inner* node = m_root.get();
+        for (auto s = m_shift; s > Bits; s -= Bits) node = &node->inner((j >> s) & Mask);
+        auto block = static_cast<typename Payload<Leaf>::Block*>(node->children[(j >> Bits) & Mask]);
+        block->addRef();
+        return Payload<Leaf>::adopt(block);
+    }
+
+    T& editableAt(size_t j)
+    {
+        if (j >= tailOffset(end_index())) return impl::editable(m_tail)[j & Mask];
+        auto node = &impl::editable(m_root);
+        for (auto s = m_shift; s > Bits; s -= Bits) node = &impl::vec::editable<Inner>(node->children[(j >> s) & Mask]);
+        return impl::vec::editable<Leaf>(node->children[(j >> Bits) & Mask])[j & Mask];
+    }
+
+    // the trie of full leaves of a new vector
+    void buildTrie(std::vector<Payload<Leaf>>& leaves)
+    {
+        if (leaves.empty()) return;
+        auto level = group(leaves, Bits);
+        m_shift = Bits;
+        while (level.size() > 1)
+        {
+            m_shift += Bits;
+            level = group(level, m_shift);
+        }
+        m_root = std::move(level.front());
+    }
+
+    // full inner nodes with shift over the nodes of a level
+    template <typename C>
+    static std::vector<Payload<Inner>> group(std::vector<Payload<C>>& nodes, uint32_t shift)
+    {
+        std::vector<Payload<Inner>> ret;
+        ret.reserve((nodes.size() + Mask) / impl::vec::Width);
+        for (auto& n : nodes)
+        {
+            if (ret.empty() || ret.back()->count == impl::vec::Width) ret.push_back(Payload<Inner>::make(shift));
+            auto& node = *ret.back();
+            node.children[node.count++] = n.releaseBlock();
+        }
+        return ret;
+    }
+
+    // moves the tail to the trie at the index tailOffset
+    void pushTail(size_t tailOffset)
+    {
+        if (!m_root)
+        {
+            m_root = Payload<Inner>::make(Bits);
+        }
+        else if (tailOffset == size_t(1) << (m_shift + Bits))
+        {
+            // the root is full: add a level
+            auto root = Payload<Inner>::make(m_shift + Bits);
+            root->children[0] = m_root.releaseBlock();
+            root->count = 1;
+            m_root = std::move(root);
+            m_shift += Bits;
+        }
+
+        auto node = &impl::editable(m_root);
+        for (auto s = m_shift; s > Bits; s -= Bits)
+        {
+            const auto i = uint32_t((tailOffset >> s) & Mask);
+            if (i == node->count)
+            {
+                node->children[i] = Payload<Inner>::make(s - Bits).releaseBlock();
+                ++node->count;
+            }
+            node = &impl::vec::editable<Inner>(node->children[i]);
+        }
+        node->children[node->count++] = m_tail.releaseBlock();
+    }
+
+    // removes the last leaf of the trie and returns it
+    Payload<Leaf> popTail()
+    {
+        Payload<Leaf> ret;
+        if (popTail(impl::editable(m_root), ret)) m_root.reset();
+        shrink();
+        return ret;
+    }
+
+    // returns true if node became empty
+    static bool popTail(Inner& node, Payload<Leaf>& out)
+    {
+        if (node.shift == Bits)
+        {
+            out = Payload<Leaf>::adopt(static_cast<typename Payload<Leaf>::Block*>(node.children[--node.count]));
+        }
+        else
+        {
+            auto& child = impl::vec::editable<Inner>(node.children[node.count - 1]);
+            if (popTail(child, out)) node.releaseBack();
+        }
+        return !node.count;
+    }
+
+    // drops everything in the trie from index end onwards (end is a multiple of the leaf size)
+    void trimTrie(size_t end)
+    {
+        if (!end)
+        {
+            m_root.reset();
+            m_shift = Bits;
+            return;
+        }
+        const auto last = end - 1;
+        auto node = &impl::editable(m_root);
+        while (true)
+        {
+            const auto i = uint32_t((last >> node->shift) & Mask);
+            while (node->count > i + 1) node->releaseBack();
+            if (node->shift == Bits) break;
+            node = &impl::vec::editable<Inner>(node->children[i]);
+        }
+        shrink();
+    }
+
+    // removes root levels with a single live child: the last one, with the offset in it
+    // (the children before it are released and null)
+    void shrink()
+    {
+        while (m_root && m_shift > Bits)
+        {
+            const auto i = uint32_t((m_offset >> m_shift) & Mask);
+            if (i + 1 != m_root->count) break;
+            auto block = static_cast<typename Payload<Inner>::Block*>(m_root->children[i]);
+            block->addRef();
+            m_root = Payload<Inner>::adopt(block);
+            m_offset -= size_t(i) << m_shift;
+            m_shift -= Bits;
+        }
+    }
+
+    // releases the nodes entirely before the offset
+    void trimFront()
+    {
+        const auto tailStart = tailOffset(end_index());
+        if (m_offset >= tailStart) return rebaseToTail(tailStart);
+
+        auto node = &impl::editable(m_root);
+        while (true)
+        {
+            const auto i = uint32_t((m_offset >> node->shift) & Mask);
+            for (uint32_t k = 0; k < i; ++k) node->release(k);
+            if (node->shift == Bits) break;
+            node = &impl::vec::editable<Inner>(node->children[i]);
+        }
+        shrink();
+    }
+
+    // drops the trie when the first element is in the tail, which starts at tailStart
+    void rebaseToTail(size_t tailStart)
+    {
+        m_root.reset();
+        m_shift = Bits;
+        m_offset -= tailStart;
+    }
+
+    Payload<Inner> m_root; // null if everything is in the tail
+    Payload<Leaf> m_tail; // null only if the vector is empty
+    uint32_t m_shift = Bits; // of the root
+    size_t m_offset = 0; // index of the first element in the trie
+    size_t m_size = 0;
+};
+
+} // namespace kuzco
@@ -0,0 +1,222 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Root.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kuzco
+{
+
+// a root owned by a dedicated writer thread
+// instead of doing transactions, producers post mutations to a lock-free queue
+// the writer applies them in batches and publishes at most once per batch
+// a batch is published when it has maxBatch mutations or maxDelay has passed since its first one
+//
+// readers use detach and read as with a regular root
+// as with other batches, if a mutation throws, the rest of its batch is applied again without it
+// so mutations shouldn't have side effects outside of the state
+template <typename T>
+class WriterThread
+{
+public:
+    struct Cadence
+    {
+        std::size_t maxBatch = 64;
+        std::chrono::microseconds maxDelay = std::chrono::microseconds(100);
+    };
+
+    explicit WriterThread(Node<T>&& obj, Cadence cadence = {}, AllocatorRef allocator = {})
+        : m_root(std::move(obj), std::move(allocator))
+        , m_cadence(cadence)
+    {
+        m_head.store(&m_stub, std::memory_order_relaxed);
+        m_tail = &m_stub;
+        m_thread = std::thread([this] { run(); });
+    }
+
+    // mutations posted before the destructor is called are applied before the thread exits
+    ~WriterThread()
+    {
+        m_stop.store(true, std::memory_order_seq_cst);
+        wake();
+        m_thread.join();
+    }
+
+    WriterThread(const WriterThread&) = delete;
+    WriterThread& operator=(const WriterThread&) = delete;
+
+    // post f(T&)
+    // done(std::exception_ptr) is called on the writer thread once the result is published
+    // (or with the exception f has thrown)
+    template <typename F, typename Done>
+    void post(F f, Done done)
+    {
+        auto item = new Item;
+        item->apply = std::move(f);
+        item->done = std::move(done);
+        push(item);
+    }
+
+    // post f(T&) and get a future which becomes ready once the result is published
+    template <typename F>
+    std::future<void> post(F f)
+    {
+        auto p = std::make_shared<std::promise<void>>();
+        auto ret = p->get_future();
+        post(std::move(f), [p](std::exception_ptr e) {
+            if (e) p->set_exception(e);
+            else p->set_value();
+        });
+        return ret;
+    }
+
+    Detached<T> detach() const { return m_root.detach(); }
+
+    template <typename F>
+    decltype(auto) read(F&& f) const { return m_root.read(std::forward<F>(f)); }
+
+private:
+    struct Item : public Root<T>::Mutation
+    {
+        std::atomic<Item*> next = nullptr;
+        std::function<void(std::exception_ptr)> done;
+    };
+
+    // intrusive multi-producer single-consumer queue (Vyukov)
+    // producers only exchange the head, the consumer follows the links from the tail
+    void push(Item* item)
+    {
+        link(item);
+        if (m_sleeping.load(std::memory_order_seq_cst)) wake();
+    }
+
+    void link(Item* item)
+    {
+        auto prev = m_head.exchange(item, std::memory_order_seq_cst);
+        prev->next.store(item, std::memory_order_release);
+    }
+
+    // returns null if the queue is empty or an item is being pushed
+    // never returns the stub
+    Item* pop()
+    {
+        auto tail = m_tail;
+        auto next = tail->next.load(std::memory_order_acquire);
+        if (tail == &m_stub)
+        {
+            if (!next) return nullptr;
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+        if (tail != m_head.load(std::memory_order_acquire)) return nullptr; // push in progress
+        // put the stub back, so the last item can be taken
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+        link(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    // called by the writer
+    // the queue is empty only when both ends are at the stub
+    bool hasItems() const
+    {
+        return m_tail != &m_stub || m_head.load(std::memory_order_seq_cst) != &m_stub;
+    }
+
+    void wake()
+    {
+        {
+            std::lock_guard l(m_sleepMutex);
+        }
+        m_sleepCv.notify_one();
+    }
+
+    void flush()
+    {
+        if (m_pending.empty()) return;
+
+        m_root.beginTransaction();
+        m_root.applyMutations(m_pending.begin(), m_pending.end());
+
+        for (auto i : m_pending)
+        {
+            i->done(i->error);
+            delete i;
+        }
+        m_pending.clear();
+    }
+
+    void run()
+    {
+        using clock = std::chrono::steady_clock;
+        clock::time_point deadline;
+
+        while (true)
+        {
+            while (auto item = pop())
+            {
+                m_pending.push_back(item);
+                if (m_pending.size() == 1) deadline = clock::now() + m_cadence.maxDelay;
+                if (m_pending.size() >= m_cadence.maxBatch) flush();
+            }
+
+            const bool stop = m_stop.load(std::memory_order_seq_cst);
+            if (stop || clock::now() >= deadline) flush();
+
+            std::unique_lock l(m_sleepMutex);
+            m_sleeping.store(true, std::memory_order_seq_cst);
+            if (!hasItems())
+            {
+                // everything posted before the stop has been applied
+                if (stop) break;
+
+                auto ready = [this] { return hasItems() || m_stop.load(std::memory_order_seq_cst); };
+                if (m_pending.empty()) m_sleepCv.wait(l, ready);
+                else m_sleepCv.wait_until(l, deadline, ready);
+            }
+            m_sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    Root<T> m_root;
+    const Cadence m_cadence;
+
+    alignas(64) std::atomic<Item*> m_head;
+    alignas(64) Item* m_tail; // consumer only
+    Item m_stub;
+    std::vector<Item*> m_pending; // consumer only
+
+    std::atomic_bool m_stop = false;
+    std::atomic_bool m_sleeping = false;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCv;
+
+    std::thread m_thread;
+};
+
+} // namespace kuzco
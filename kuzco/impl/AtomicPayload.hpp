@@ -0,0 +1,139 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "../Payload.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+namespace kuzco::impl
+{
+
+// a payload which can be loaded and stored from multiple threads without locks
+//
+// it uses split reference counts:
+// the pointer to the block and a "local" count are packed in a single atomic word
+// a reader increments the local count with a single fetch_add, which keeps the block alive,
+// then adds a real reference to the block and finally gives back the local one
+// a writer which replaces the block transfers the local count of the old one to the block itself
+// so readers which still have their local reference there, drop a real one instead
+//
+// on 64-bit platforms the upper 16 bits of the pointer are used for the local count
+// (user space addresses fit in 48 bits), so there can be up to 65535 concurrent loads
+// storing a pointer which doesn't fit in 48 bits aborts the program
+template <typename T>
+class AtomicPayload
+{
+public:
+    using Block = typename Payload<T>::Block;
+
+    AtomicPayload() = default;
+    AtomicPayload(const AtomicPayload&) = delete;
+    AtomicPayload& operator=(const AtomicPayload&) = delete;
+
+    ~AtomicPayload() { transfer(m_packed.load(std::memory_order_acquire)); }
+
+    Payload<T> load() const
+    {
+        // take a local reference
+        auto packed = m_packed.fetch_add(One_Local, std::memory_order_acquire);
+        auto block = blockOf(packed);
+        if (!block)
+        {
+            giveBack(packed + One_Local, nullptr);
+            return {};
+        }
+
+        // the local one keeps the block alive, so this is safe
+        block->addRef();
+
+        if (!giveBack(packed + One_Local, block))
+        {
+            // the local reference was transferred to the block by a writer
+            // so we now own two real references
+            block->refCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        return Payload<T>::adopt(block);
+    }
+
+    void store(Payload<T> p)
+    {
+        exchange(std::move(p));
+    }
+
+    // stores p and returns the previous payload
+    Payload<T> exchange(Payload<T> p)
+    {
+        auto old = m_packed.exchange(pack(p.releaseBlock()), std::memory_order_seq_cst);
+        return transfer(old);
+    }
+
+    // returns the current value without taking a reference
+    // the caller must guarantee that it stays alive by other means (for example epochs)
+    const T* peek() const
+    {
+        auto block = blockOf(m_packed.load(std::memory_order_seq_cst));
+        return block ? &block->value : nullptr;
+    }
+
+private:
+    using Word = uint64_t;
+    static_assert(std::atomic<Word>::is_always_lock_free);
+
+    static constexpr int Ptr_Bits = sizeof(void*) == 8 ? 48 : 32;
+    static constexpr Word Ptr_Mask = (Word(1) << Ptr_Bits) - 1;
+    static constexpr Word One_Local = Word(1) << Ptr_Bits;
+
+    static Block* blockOf(Word w) { return reinterpret_cast<Block*>(uintptr_t(w & Ptr_Mask)); }
+    static Word localsOf(Word w) { return w >> Ptr_Bits; }
+
+    static Word pack(Block* b)
+    {
+        auto w = Word(reinterpret_cast<uintptr_t>(b));
+        // the local count would overwrite the upper bits of pointers which don't fit
+        // (with 57-bit addresses of 5-level paging, if the allocator hands them out,
+        // or with tagged pointers such as arm memory tagging)
+        // stores are rare enough for the check to always be on
+        if (w & ~Ptr_Mask) std::abort();
+        return w;
+    }
+
+    // try to return a local reference
+    // returns false if it was already transferred to the block
+    bool giveBack(Word expected, Block* block) const
+    {
+        while (true)
+        {
+            // if the block was replaced, our local reference went with it
+            // if the local count is zero, the block was replaced and then stored again (ABA)
+            // in which case our local reference also went to the block
+            // local references are interchangeable, so it's only the totals that matter
+            if (blockOf(expected) != block || localsOf(expected) == 0) return false;
+            if (m_packed.compare_exchange_weak(expected, expected - One_Local, std::memory_order_relaxed)) return true;
+        }
+    }
+
+    // returns the reference held by the atomic word as a payload
+    static Payload<T> transfer(Word w)
+    {
+        auto block = blockOf(w);
+        if (!block) return {};
+        // first add the local references of the readers which haven't given them back
+        // so the count can't reach zero before they've converted them to real ones
+        auto locals = localsOf(w);
+        if (locals) block->refCount.fetch_add(uint32_t(locals), std::memory_order_relaxed);
+        return Payload<T>::adopt(block);
+    }
+
+    mutable std::atomic<Word> m_packed = 0;
+};
+
+} // namespace kuzco::impl
@@ -0,0 +1,145 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Coro.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace kuzco::impl
+{
+
+// wakes threads and coroutines which wait for a condition on the published state of a root
+// writers call notify after each publish: it's a single atomic load if no one is waiting
+// conditions are checked under an internal mutex, so they should be cheap
+//
+// the condition must become true only through a publish which is followed by notify
+// (writers publish, then load the waiter count, waiters increment it, then check: all seq_cst)
+class CommitSignal
+{
+public:
+    CommitSignal() = default;
+    CommitSignal(const CommitSignal&) = delete;
+    CommitSignal& operator=(const CommitSignal&) = delete;
+
+    // queued waiters live in whoever waits (say a coroutine frame)
+    // a waiter destroyed while queued leaves the queue
+    // the queue is there with or without coroutine support, so the layout doesn't depend on the language standard
+    struct Waiter
+    {
+        Waiter* next = nullptr;
+        // called with the internal mutex locked
+        virtual bool ready() = 0;
+        // called without locks, once the waiter has left the queue
+        virtual void wake() = 0;
+    protected:
+        Waiter() = default;
+        Waiter(const Waiter&) = delete;
+        Waiter& operator=(const Waiter&) = delete;
+        ~Waiter() { if (signal) signal->cancel(this); }
+    private:
+        friend class CommitSignal;
+        CommitSignal* signal = nullptr; // while queued
+    };
+
+    void notify()
+    {
+        if (!m_waiting.load(std::memory_order_seq_cst)) return;
+
+        Waiter* ready = nullptr;
+        {
+            std::lock_guard l(m_mutex);
+            for (auto p = &m_first; *p;)
+            {
+                auto w = *p;
+                if (w->ready())
+                {
+                    *p = w->next;
+                    w->next = ready;
+                    w->signal = nullptr; // no longer queued
+                    ready = w;
+                    m_waiting.fetch_sub(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    p = &w->next;
+                }
+            }
+        }
+        m_cv.notify_all();
+
+        while (ready)
+        {
+            auto w = ready;
+            ready = w->next; // w may be gone after waking
+            w->wake();
+        }
+    }
+
+    // blocks until ready() returns true
+    template <typename Ready>
+    void wait(Ready ready)
+    {
+        std::unique_lock l(m_mutex);
+        m_waiting.fetch_add(1, std::memory_order_seq_cst);
+        m_cv.wait(l, ready);
+        m_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // returns false if w is already ready, so there's no need to wait
+    // otherwise w is queued and woken once it becomes ready
+    bool suspend(Waiter* w)
+    {
+        std::lock_guard l(m_mutex);
+        m_waiting.fetch_add(1, std::memory_order_seq_cst);
+        if (w->ready())
+        {
+            m_waiting.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        w->next = m_first;
+        m_first = w;
+        w->signal = this;
+        return true;
+    }
+
+#if KUZCO_HAS_COROUTINES
+    // resumes handle through resumer
+    struct AsyncWaiter : public Waiter
+    {
+        Resumer resumer;
+        std::coroutine_handle<> handle;
+        void wake() override { resume(resumer, handle); }
+    protected:
+        AsyncWaiter() = default;
+        ~AsyncWaiter() = default;
+    };
+#endif
+
+private:
+    void cancel(Waiter* w)
+    {
+        std::lock_guard l(m_mutex);
+        for (auto p = &m_first; *p; p = &(*p)->next)
+        {
+            if (*p != w) continue;
+            *p = w->next;
+            m_waiting.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    std::atomic_uint32_t m_waiting = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    Waiter* m_first = nullptr;
+};
+
+} // namespace kuzco::impl
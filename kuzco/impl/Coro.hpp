@@ -0,0 +1,61 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+// coroutine support is optional: awaitable apis are only available when compiling as C++20 or later
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#   define KUZCO_HAS_COROUTINES 1
+#   include <coroutine>
+#   include <deque>
+#   include <functional>
+namespace kuzco
+{
+// resumes a suspended coroutine
+// an empty resumer means resume inline (on the thread which allows the coroutine to continue)
+// to resume through an executor, post the handle to it: [&](std::coroutine_handle<> h) { pool.post([h] { h.resume(); }); }
+//
+// inline resumptions don't nest: a coroutine which allows another one to continue
+// (say by ending a transaction another one waits for) doesn't run it on top of its own stack
+// it's queued and resumed when the outermost inline resumption on the thread returns
+// so a chain of coroutines handing over the transaction lock doesn't grow the stack
+using Resumer = std::function<void(std::coroutine_handle<>)>;
+
+namespace impl
+{
+inline void resume(const Resumer& r, std::coroutine_handle<> h)
+{
+    if (r) return r(h);
+
+    struct Trampoline
+    {
+        bool running = false;
+        std::deque<std::coroutine_handle<>> pending;
+    };
+    static thread_local Trampoline t;
+
+    if (t.running)
+    {
+        t.pending.push_back(h);
+        return;
+    }
+
+    t.running = true;
+    h.resume();
+    while (!t.pending.empty())
+    {
+        auto next = t.pending.front();
+        t.pending.pop_front();
+        next.resume();
+    }
+    t.running = false;
+}
+} // namespace impl
+} // namespace kuzco
+#else
+#   define KUZCO_HAS_COROUTINES 0
+#endif
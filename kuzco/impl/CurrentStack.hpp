@@ -0,0 +1,54 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include <vector>
+
+namespace kuzco::impl
+{
+
+// the values which transactions make current for a thread (allocators, journals)
+// a thread can have transactions of several roots in progress and they don't have to end in reverse order
+// so each owner's entry is removed wherever it is and the current value is the one of the newest remaining entry
+// (or the one which was current before the first entry, once there are none)
+template <typename T>
+class CurrentStack
+{
+public:
+    // makes value current for owner
+    // cur is the current value of the thread
+    void push(const void* owner, T* value, T*& cur)
+    {
+        if (m_entries.empty()) m_base = cur;
+        m_entries.push_back({owner, value});
+        cur = value;
+    }
+
+    // removes the entry of owner and updates the current value
+    void pop(const void* owner, T*& cur) noexcept
+    {
+        for (auto i = m_entries.size(); i--;)
+        {
+            if (m_entries[i].owner != owner) continue;
+            m_entries.erase(m_entries.begin() + i);
+            break;
+        }
+        cur = m_entries.empty() ? m_base : m_entries.back().value;
+    }
+
+private:
+    struct Entry
+    {
+        const void* owner;
+        T* value;
+    };
+    std::vector<Entry> m_entries;
+    T* m_base = nullptr;
+};
+
+} // namespace kuzco::impl
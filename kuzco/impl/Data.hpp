@@ -7,30 +7,112 @@
 //
 #pragma once
 
-#include <memory>
+#include "../Payload.hpp"
+
+#include <cstdint>
 
 namespace kuzco::impl
 {
 
 // a unit of state information
+// a single tagged pointer to a payload block
+// the lowest bit of the pointer is free (blocks are at least 4-byte aligned) and holds a flag for the owner
+// (nodes use it for uniqueness)
+//
+// copying and moving transfer only the payload
+// the flag of the destination is preserved on assignment and is cleared on construction
 template <typename T>
-struct Data
+class Data
 {
-    using Payload = std::shared_ptr<T>;
+public:
+    using Payload = kuzco::Payload<T>;
+    using Block = typename Payload::Block;
+
+    Data() noexcept = default;
+
+    explicit Data(Payload p) noexcept
+        : m_bits(bitsOf(p.releaseBlock()))
+    {}
+
+    Data(const Data& other) noexcept
+        : m_bits(other.m_bits & ~Flag_Mask)
+    {
+        addRef();
+    }
+
+    Data(Data&& other) noexcept
+        : m_bits(other.m_bits & ~Flag_Mask)
+    {
+        other.m_bits &= Flag_Mask;
+    }
 
-    T* qdata = nullptr; // quick access pointer to save dereferencs of the internal shared pointer
-    Payload payload;
+    Data& operator=(const Data& other) noexcept
+    {
+        if (this == &other) return *this;
+        other.addRef();
+        releaseRef();
+        m_bits = (other.m_bits & ~Flag_Mask) | (m_bits & Flag_Mask);
+        return *this;
+    }
+
+    Data& operator=(Data&& other) noexcept
+    {
+        if (this == &other) return *this;
+        releaseRef();
+        m_bits = (other.m_bits & ~Flag_Mask) | (m_bits & Flag_Mask);
+        other.m_bits &= Flag_Mask;
+        return *this;
+    }
+
+    ~Data() { releaseRef(); }
 
     // not guarding this through enable_if
     // all calls to this function should be guarded from the callers
     template <typename... Args>
     static Data construct(Args&&... args)
     {
-        Data ret;
-        ret.payload = std::make_shared<T>(std::forward<Args>(args)...);
-        ret.qdata = ret.payload.get();
-        return ret;
+        return Data(Payload::make(std::forward<Args>(args)...));
     }
+
+    // quick access to the data
+    // it's at a fixed offset from the block pointer, so no dereferencing is involved
+    T* get() const noexcept
+    {
+        auto b = block();
+        return b ? &b->value : nullptr;
+    }
+
+    Payload payload() const noexcept
+    {
+        addRef();
+        return Payload::adopt(block());
+    }
+
+    bool flag() const noexcept { return m_bits & Flag_Mask; }
+    void setFlag(bool f) noexcept { m_bits = (m_bits & ~Flag_Mask) | uintptr_t(f); }
+
+private:
+    static constexpr uintptr_t Flag_Mask = 1;
+
+    static uintptr_t bitsOf(Block* b) noexcept
+    {
+        static_assert(alignof(Block) > Flag_Mask, "no room for the flag in the block pointer");
+        return reinterpret_cast<uintptr_t>(b);
+    }
+
+    Block* block() const noexcept { return reinterpret_cast<Block*>(m_bits & ~Flag_Mask); }
+
+    void addRef() const noexcept
+    {
+        if (auto b = block()) b->addRef();
+    }
+
+    void releaseRef() noexcept
+    {
+        Payload::adopt(block()).reset();
+    }
+
+    uintptr_t m_bits = 0;
 };
 
 } // namespace kuzco::impl
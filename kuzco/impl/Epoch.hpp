@@ -0,0 +1,259 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace kuzco::impl
+{
+
+// epoch based reclamation
+//
+// readers announce the epoch of the domain in a per-thread slot while they're reading
+// writers retire objects instead of releasing them and each retired object is tagged with an epoch
+// a retired object is released when every reader which is still reading has announced a later epoch
+// readers never write to a shared cache line, so reads don't bounce between cores
+//
+// the announcement of readers, the publication of objects and the scan of announcements
+// are all seq_cst, so a reader which got an old object is always seen by the scan
+//
+// reads only touch the slot of the reading thread: leaving is a single store
+// so retired objects are never released by readers, but by the writers:
+// each retire releases what's safe to release (including objects retired before it)
+// what readers still held back at the last retire waits for the next one, reclaim, or the destruction of the domain
+class EpochDomain
+{
+public:
+    using ReleaseFunc = void(*)(void*);
+
+    EpochDomain()
+        : m_id(Registry::instance().add())
+    {}
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    ~EpochDomain()
+    {
+        // exiting threads no longer touch the slots after this
+        Registry::instance().remove(m_id);
+
+        // no one can be reading at this point
+        for (auto& r : m_retired) r.release(r.obj);
+        for (auto s = m_slots.load(); s;)
+        {
+            auto next = s->next;
+            delete s;
+            s = next;
+        }
+    }
+
+    void enter()
+    {
+        auto& s = threadSlot();
+        if (s.nesting++) return;
+        // the announcement must be visible before any pointers are loaded
+        // (they are loaded with seq_cst as well)
+        s.epoch.store(m_epoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+    }
+
+    void leave()
+    {
+        auto& s = threadSlot();
+        if (--s.nesting) return;
+        // nothing is read after this, so it only needs to be ordered after the reads
+        s.epoch.store(0, std::memory_order_release);
+    }
+
+    // call release(obj) once no reader can be accessing obj
+    // obj must already be unreachable for new readers
+    void retire(void* obj, ReleaseFunc release)
+    {
+        auto e = m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        {
+            std::lock_guard l(m_retiredMutex);
+            m_retired.push_back({obj, release, e});
+        }
+        reclaim();
+    }
+
+    // release whatever is safe to release
+    void reclaim()
+    {
+        std::vector<Retired> ready;
+        {
+            std::lock_guard l(m_retiredMutex);
+            if (m_retired.empty()) return;
+
+            auto minActive = minActiveEpoch();
+
+            auto keep = m_retired.begin();
+            for (auto& r : m_retired)
+            {
+                if (r.epoch < minActive) ready.push_back(r);
+                else *keep++ = r;
+            }
+            m_retired.erase(keep, m_retired.end());
+        }
+
+        // releasing can be arbitrarily expensive (and may retire more objects), so do it outside of the lock
+        for (auto& r : ready) r.release(r.obj);
+    }
+
+private:
+    struct alignas(64) Slot
+    {
+        std::atomic_uint64_t epoch = 0; // zero while not reading
+        std::atomic_bool used = true;
+        uint32_t nesting = 0; // only accessed by the owning thread
+        Slot* next = nullptr;
+    };
+
+    struct Retired
+    {
+        void* obj;
+        ReleaseFunc release;
+        uint64_t epoch;
+    };
+
+    // ids of live domains
+    // a thread which exits gives its slots back only to domains which are still alive
+    // ids are never reused, so a thread can't confuse a new domain with a destroyed one
+    class Registry
+    {
+    public:
+        static Registry& instance()
+        {
+            static Registry r;
+            return r;
+        }
+
+        uint64_t add()
+        {
+            std::lock_guard l(mutex);
+            live.push_back(++lastId);
+            return lastId;
+        }
+
+        void remove(uint64_t id)
+        {
+            std::lock_guard l(mutex);
+            live.erase(std::find(live.begin(), live.end(), id));
+        }
+
+        bool alive(uint64_t id) const { return std::find(live.begin(), live.end(), id) != live.end(); }
+
+        std::mutex mutex;
+
+    private:
+        uint64_t lastId = 0;
+        std::vector<uint64_t> live;
+    };
+
+    // slots of the current thread in the domains it has read from
+    class ThreadSlots
+    {
+    public:
+        static ThreadSlots& instance()
+        {
+            static thread_local ThreadSlots s;
+            return s;
+        }
+
+        ~ThreadSlots()
+        {
+            auto& r = Registry::instance();
+            std::lock_guard l(r.mutex);
+            for (auto& e : entries)
+            {
+                if (r.alive(e.id)) e.slot->used.store(false, std::memory_order_release);
+            }
+        }
+
+        // drop entries of destroyed domains
+        void prune()
+        {
+            auto& r = Registry::instance();
+            std::lock_guard l(r.mutex);
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const Entry& e) {
+                return !r.alive(e.id);
+            }), entries.end());
+        }
+
+        struct Entry
+        {
+            uint64_t id;
+            Slot* slot;
+        };
+        std::vector<Entry> entries; // a thread usually reads from few domains
+    };
+
+    uint64_t minActiveEpoch() const
+    {
+        uint64_t ret = UINT64_MAX;
+        for (auto s = m_slots.load(std::memory_order_acquire); s; s = s->next)
+        {
+            auto e = s->epoch.load(std::memory_order_seq_cst);
+            if (e && e < ret) ret = e;
+        }
+        return ret;
+    }
+
+    Slot& threadSlot()
+    {
+        auto& ts = ThreadSlots::instance();
+        for (auto& e : ts.entries)
+        {
+            if (e.id == m_id) return *e.slot;
+        }
+        ts.prune();
+        auto s = acquireSlot();
+        ts.entries.push_back({m_id, s});
+        return *s;
+    }
+
+    Slot* acquireSlot()
+    {
+        // reuse a slot of a thread which has exited
+        for (auto s = m_slots.load(std::memory_order_acquire); s; s = s->next)
+        {
+            bool expected = false;
+            if (s->used.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) return s;
+        }
+
+        auto s = new Slot;
+        s->next = m_slots.load(std::memory_order_relaxed);
+        while (!m_slots.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed));
+        return s;
+    }
+
+    const uint64_t m_id;
+
+    std::atomic_uint64_t m_epoch = 1;
+    std::atomic<Slot*> m_slots = nullptr; // append-only list
+
+    std::mutex m_retiredMutex;
+    std::vector<Retired> m_retired;
+};
+
+class EpochGuard
+{
+public:
+    explicit EpochGuard(EpochDomain& d) : m_domain(d) { m_domain.enter(); }
+    ~EpochGuard() { m_domain.leave(); }
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+private:
+    EpochDomain& m_domain;
+};
+
+} // namespace kuzco::impl
@@ -0,0 +1,108 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace kuzco::impl
+{
+
+// an array of up to N elements stored in place
+// used for the nodes of persistent containers
+// unlike std::array it doesn't construct the elements it doesn't hold
+template <typename T, uint32_t N>
+class FixedArray
+{
+public:
+    FixedArray() = default;
+
+    FixedArray(const FixedArray& other)
+    {
+        for (auto& e : other) push_back(e);
+    }
+
+    FixedArray& operator=(const FixedArray&) = delete;
+
+    ~FixedArray() { truncate(0); }
+
+    uint32_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+    bool full() const { return m_size == N; }
+
+    T* data() { return std::launder(reinterpret_cast<T*>(m_buf)); }
+    const T* data() const { return std::launder(reinterpret_cast<const T*>(m_buf)); }
+
+    T& operator[](uint32_t i) { return data()[i]; }
+    const T& operator[](uint32_t i) const { return data()[i]; }
+
+    T& back() { return data()[m_size - 1]; }
+    const T& back() const { return data()[m_size - 1]; }
+
+    T* begin() { return data(); }
+    T* end() { return data() + m_size; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + m_size; }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        auto ret = new (m_buf + m_size * sizeof(T)) T(std::forward<Args>(args)...);
+        ++m_size;
+        return *ret;
+    }
+
+    void push_back(const T& t) { emplace_back(t); }
+    void push_back(T&& t) { emplace_back(std::move(t)); }
+
+    void pop_back() { data()[--m_size].~T(); }
+
+    // destroy the elements from n onwards
+    void truncate(uint32_t n)
+    {
+        while (m_size > n) pop_back();
+    }
+
+    // insert at i, shifting the following elements
+    // elements are shifted by move construction, not by assignment:
+    // assigning a node replaces its data and doesn't keep the fact that it's shared with other handles
+    // (moves are expected not to throw)
+    template <typename U>
+    void insert(uint32_t i, U&& u)
+    {
+        T value(std::forward<U>(u)); // u may be an element of this array
+        if (i == m_size)
+        {
+            emplace_back(std::move(value));
+            return;
+        }
+        emplace_back(std::move(back()));
+        for (uint32_t j = m_size - 2; j > i; --j) replace(j, std::move(data()[j - 1]));
+        replace(i, std::move(value));
+    }
+
+    // erase at i, shifting the following elements
+    void erase(uint32_t i)
+    {
+        for (uint32_t j = i; j + 1 < m_size; ++j) replace(j, std::move(data()[j + 1]));
+        pop_back();
+    }
+
+private:
+    void replace(uint32_t i, T&& t)
+    {
+        data()[i].~T();
+        new (m_buf + i * sizeof(T)) T(std::move(t));
+    }
+
+    uint32_t m_size = 0;
+    alignas(T) unsigned char m_buf[N * sizeof(T)];
+};
+
+} // namespace kuzco::impl
@@ -0,0 +1,128 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "../Diff.hpp"
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace kuzco::impl
+{
+
+// three-way merge of snapshots for optimistic transactions
+// ours and theirs are two states built from the same base
+// a value changed only on one side is taken from it
+// objects with fields (see kuzcoFields in Diff.hpp) changed on both sides are merged field by field
+// anything else changed on both sides is a conflict, even if both changed it to the same value
+// (both could have computed it from the value in base, like n = n + 1, and one of the updates would be lost)
+//
+// like diffs, handles are compared by payload, so only the nodes cloned on both sides are visited
+// the merged objects are new payloads from the current allocator
+class Merger
+{
+public:
+    // returns false on conflict
+    template <typename V>
+    static bool object(const Payload<V>& base, const Payload<V>& ours, const Payload<V>& theirs, Payload<V>& out)
+    {
+        if (ours == base)
+        {
+            out = theirs;
+            return true;
+        }
+        if (theirs == base)
+        {
+            out = ours;
+            return true;
+        }
+
+        using U = std::remove_const_t<V>;
+        if constexpr (HasFields<U>::value)
+        {
+            if (base && ours && theirs)
+            {
+                auto merged = Payload<U>::make(std::as_const(*theirs));
+                if (!fields<U>(*base, *ours, *theirs, *merged)) return false;
+                out = std::move(merged);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    template <typename M, typename = void>
+    struct IsHolder : std::false_type {};
+    template <typename M>
+    struct IsHolder<M, std::enable_if_t<std::is_base_of_v<DataHolder<typename M::Type>, M>>> : std::true_type {};
+
+    // out is a copy of theirs
+    template <typename V>
+    static bool fields(const V& base, const V& ours, const V& theirs, V& out)
+    {
+        return std::apply([&](auto... f) {
+            return (member(base.*(f.ptr), ours.*(f.ptr), theirs.*(f.ptr), out.*(f.ptr)) && ...);
+        }, kuzcoFields(static_cast<const V*>(nullptr)));
+    }
+
+    template <typename M>
+    static bool member(const M& base, const M& ours, const M& theirs, M& out)
+    {
+        if constexpr (IsHolder<M>::value)
+        {
+            if (ours.qget() == base.qget()) return true;
+
+            using X = std::remove_const_t<typename M::Type>;
+            Payload<const X> merged;
+            if (!object(base.payload(), ours.payload(), theirs.payload(), merged)) return false;
+            out.m_data = Data<typename M::Type>(Payload<typename M::Type>::adopt(merged.releaseBlock()));
+            return true;
+        }
+        else if constexpr (IsHandle<M>::value)
+        {
+            // inline leaves: compared by value
+            return plain(base, ours, theirs, out);
+        }
+        else if constexpr (HasFields<M>::value)
+        {
+            return fields<M>(base, ours, theirs, out);
+        }
+        else if constexpr (IsEqualityComparable<M>::value)
+        {
+            return plain(base, ours, theirs, out);
+        }
+        else
+        {
+            // nothing to compare with and the owner was changed on both sides
+            return false;
+        }
+    }
+
+    template <typename M>
+    static bool plain(const M& base, const M& ours, const M& theirs, M& out)
+    {
+        if (ours == base) return true;
+        if (!(theirs == base)) return false;
+
+        // copied, then moved: copy assignment is deleted for nodes (and containers of them)
+        if constexpr (std::is_move_assignable_v<M>)
+        {
+            M copy(ours);
+            out = std::move(copy);
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+};
+
+} // namespace kuzco::impl
@@ -0,0 +1,171 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace kuzco::impl
+{
+
+// queue of dead payload blocks waiting to be destroyed by a Reclaimer
+// it's only used while a reclaimer is running
+//
+// producers (whoever drops the last reference to a payload) push to a lock-free list
+// and only wake the reclaimer if it's sleeping, so a burst of releases costs one notification
+// the reclaimer takes the entire list at once
+class ReclaimQueue
+{
+public:
+    using DestroyFunc = void(*)(void*);
+
+    struct Item
+    {
+        void* block;
+        DestroyFunc destroy;
+    };
+
+    static ReclaimQueue& instance()
+    {
+        // intentionally leaked, so payloads can be released during static destruction
+        static ReclaimQueue* q = new ReclaimQueue;
+        return *q;
+    }
+
+    // returns false if the block should be destroyed by the caller
+    bool push(void* block, DestroyFunc destroy) noexcept
+    {
+        if (!m_enabled.load(std::memory_order_relaxed) || destroyInline()) return false;
+
+        auto n = new (std::nothrow) Entry{{block, destroy}, nullptr};
+        if (!n) return false;
+
+        // the reclaimer could have been stopped in the meantime
+        // it waits for pushes which have seen it enabled before it takes the list for the last time
+        m_pushing.fetch_add(1, std::memory_order_seq_cst);
+        if (!m_enabled.load(std::memory_order_seq_cst))
+        {
+            m_pushing.fetch_sub(1, std::memory_order_relaxed);
+            delete n;
+            return false;
+        }
+
+        n->next = m_head.load(std::memory_order_relaxed);
+        while (!m_head.compare_exchange_weak(n->next, n, std::memory_order_seq_cst, std::memory_order_relaxed));
+        m_pushing.fetch_sub(1, std::memory_order_release);
+
+        if (m_sleeping.load(std::memory_order_seq_cst)) wake();
+        return true;
+    }
+
+    // used by the reclaimer
+    // throws if there already is one
+    void enable()
+    {
+        if (m_attached.exchange(true, std::memory_order_acq_rel)) throw std::logic_error("kuzco::Reclaimer: there can be only one at a time");
+        m_enabled.store(true, std::memory_order_seq_cst);
+    }
+
+    void disable()
+    {
+        m_enabled.store(false, std::memory_order_seq_cst);
+        wake();
+    }
+
+    // after the reclaimer thread has exited
+    void detach()
+    {
+        m_attached.store(false, std::memory_order_release);
+    }
+
+    // waits for items and appends all of them to out
+    // returns false once disabled and there are no more items
+    bool waitAndTake(std::vector<Item>& out)
+    {
+        while (true)
+        {
+            if (auto list = m_head.exchange(nullptr, std::memory_order_acquire))
+            {
+                while (list)
+                {
+                    out.push_back(list->item);
+                    delete std::exchange(list, list->next);
+                }
+                return true;
+            }
+
+            if (!m_enabled.load(std::memory_order_seq_cst))
+            {
+                if (!m_pushing.load(std::memory_order_seq_cst) && !m_head.load(std::memory_order_acquire)) return false;
+                std::this_thread::yield(); // a push which has seen it enabled is in progress
+                continue;
+            }
+
+            std::unique_lock l(m_sleepMutex);
+            m_sleeping.store(true, std::memory_order_seq_cst);
+            m_sleepCv.wait(l, [this] {
+                return m_head.load(std::memory_order_seq_cst) || !m_enabled.load(std::memory_order_seq_cst);
+            });
+            m_sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // while set, blocks released on this thread are destroyed by it, not queued
+    // it's always set on the reclaimer thread (it destroys the children of the blocks it destroys inline)
+    static bool& destroyInline()
+    {
+        static thread_local bool b = false;
+        return b;
+    }
+
+    // sets destroyInline in a scope
+    // for code which needs released blocks to be gone when it continues
+    class InlineScope
+    {
+    public:
+        InlineScope() : m_prev(destroyInline()) { destroyInline() = true; }
+        ~InlineScope() { destroyInline() = m_prev; }
+        InlineScope(const InlineScope&) = delete;
+        InlineScope& operator=(const InlineScope&) = delete;
+    private:
+        bool m_prev;
+    };
+
+private:
+    ReclaimQueue() = default;
+
+    struct Entry
+    {
+        Item item;
+        Entry* next;
+    };
+
+    void wake()
+    {
+        {
+            std::lock_guard l(m_sleepMutex);
+        }
+        m_sleepCv.notify_one();
+    }
+
+    alignas(64) std::atomic<Entry*> m_head = nullptr;
+    std::atomic_uint32_t m_pushing = 0;
+    alignas(64) std::atomic_bool m_enabled = false;
+    std::atomic_bool m_attached = false;
+    std::atomic_bool m_sleeping = false;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCv;
+};
+
+} // namespace kuzco::impl
@@ -0,0 +1,181 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#pragma once
+
+#include "Coro.hpp"
+
+#include <condition_variable>
+#include <mutex>
+
+namespace kuzco::impl
+{
+
+// the lock of root transactions
+// unlike std::mutex it's not bound to a thread: it can be unlocked by a thread different from the one which locked it
+// which makes it usable across suspension points of coroutines
+// it can be acquired by blocking a thread, or (with coroutine support) by suspending a coroutine
+// waiters are served in FIFO order: unlock hands the lock directly to the first one
+class TransactionLock
+{
+    // waiters live on the stack (or in the coroutine frame) of whoever waits
+    struct Waiter
+    {
+        Waiter* next = nullptr;
+        bool granted = false;
+        // called with the internal mutex locked
+        virtual void wake(std::unique_lock<std::mutex>& l) = 0;
+    protected:
+        ~Waiter() = default;
+    };
+
+    struct SyncWaiter : public Waiter
+    {
+        std::condition_variable cv;
+        void wake(std::unique_lock<std::mutex>&) override { cv.notify_one(); }
+    };
+
+public:
+    TransactionLock() = default;
+    TransactionLock(const TransactionLock&) = delete;
+    TransactionLock& operator=(const TransactionLock&) = delete;
+
+    void lock()
+    {
+        std::unique_lock l(m_mutex);
+        if (!m_locked)
+        {
+            m_locked = true;
+            return;
+        }
+
+        SyncWaiter w;
+        enqueue(&w);
+        w.cv.wait(l, [&] { return w.granted; });
+    }
+
+    bool try_lock()
+    {
+        std::lock_guard l(m_mutex);
+        if (m_locked) return false;
+        m_locked = true;
+        return true;
+    }
+
+    void unlock()
+    {
+        std::unique_lock l(m_mutex);
+        release(l);
+    }
+
+#if KUZCO_HAS_COROUTINES
+    // awaitable which acquires the lock
+    // the coroutine is resumed through the resumer once the lock is handed to it
+    // if the coroutine is destroyed while waiting, it leaves the queue
+    // (or passes the lock on, if it was handed to it but it was never resumed)
+    class LockAwaitable
+    {
+    public:
+        LockAwaitable(TransactionLock& lock, Resumer resumer)
+            : m_lock(lock)
+            , m_waiter(std::move(resumer))
+        {}
+
+        LockAwaitable(const LockAwaitable&) = delete;
+        LockAwaitable& operator=(const LockAwaitable&) = delete;
+
+        ~LockAwaitable()
+        {
+            if (m_waiter.handle && !m_resumed) m_lock.cancel(&m_waiter);
+        }
+
+        bool await_ready() { return m_lock.try_lock(); }
+
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            std::lock_guard l(m_lock.m_mutex);
+            if (!m_lock.m_locked)
+            {
+                // released in the meantime
+                m_lock.m_locked = true;
+                return false;
+            }
+            m_waiter.handle = h;
+            m_lock.enqueue(&m_waiter);
+            return true;
+        }
+
+        void await_resume() { m_resumed = true; }
+
+    private:
+        TransactionLock& m_lock;
+        struct AsyncWaiter : public Waiter
+        {
+            explicit AsyncWaiter(Resumer r) : resumer(std::move(r)) {}
+            void wake(std::unique_lock<std::mutex>& l) override
+            {
+                l.unlock();
+                resume(resumer, handle);
+            }
+            Resumer resumer;
+            std::coroutine_handle<> handle; // set when enqueued
+        } m_waiter;
+        bool m_resumed = false;
+    };
+
+    LockAwaitable lockAsync(Resumer resumer = {}) { return LockAwaitable(*this, std::move(resumer)); }
+#endif
+
+private:
+    void enqueue(Waiter* w)
+    {
+        if (m_last) m_last->next = w;
+        else m_first = w;
+        m_last = w;
+    }
+
+    // unlocks or hands the lock over to the first waiter
+    void release(std::unique_lock<std::mutex>& l)
+    {
+        auto w = m_first;
+        if (!w)
+        {
+            m_locked = false;
+            return;
+        }
+
+        // hand over the lock (it stays locked)
+        m_first = w->next;
+        if (!m_first) m_last = nullptr;
+        w->granted = true;
+        w->wake(l);
+    }
+
+    // called for a waiter which will never be woken (a coroutine destroyed while waiting)
+    void cancel(Waiter* w)
+    {
+        std::unique_lock l(m_mutex);
+        if (w->granted) return release(l);
+
+        Waiter* prev = nullptr;
+        for (auto p = m_first; p; prev = p, p = p->next)
+        {
+            if (p != w) continue;
+            if (prev) prev->next = w->next;
+            else m_first = w->next;
+            if (m_last == w) m_last = prev;
+            return;
+        }
+    }
+
+    std::mutex m_mutex;
+    bool m_locked = false;
+    Waiter* m_first = nullptr;
+    Waiter* m_last = nullptr;
+};
+
+} // namespace kuzco::impl
@@ -0,0 +1,139 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include <kuzco/Root.hpp>
+#include <kuzco/PoolAllocator.hpp>
+#include <kuzco/Reclaimer.hpp>
+#include <kuzco/TransactionArena.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kuzco;
+
+struct State
+{
+    int a = 0;
+    std::string s;
+};
+
+void transactionsEndingOutOfOrder()
+{
+    auto aa = AllocatorRef::make<PoolAllocator>();
+    auto ab = AllocatorRef::make<PoolAllocator>();
+    Root<State> a(Node<State>{}, aa);
+    Root<State> b(Node<State>{}, ab);
+
+    CHECK(Allocator::current() == nullptr);
+    a.beginTransaction();
+    CHECK(Allocator::current() == aa.get());
+    b.beginTransaction();
+    CHECK(Allocator::current() == ab.get());
+
+    // a ends first: b's allocator stays current
+    a.endTransaction();
+    CHECK(Allocator::current() == ab.get());
+    b.endTransaction();
+    CHECK(Allocator::current() == nullptr);
+
+    // nested in the usual order
+    a.beginTransaction();
+    b.beginTransaction();
+    b.endTransaction();
+    CHECK(Allocator::current() == aa.get());
+    a.endTransaction();
+    CHECK(Allocator::current() == nullptr);
+}
+
+void payloadsFromTheRootAllocator()
+{
+    auto alloc = AllocatorRef::make<PoolAllocator>();
+    Root<State> root(Node<State>{}, alloc);
+    root.beginTransaction();
+    root.transactionData()->a = 5;
+    root.endTransaction();
+    auto d = root.detach();
+    CHECK(d->a == 5);
+    CHECK(Allocator::fromId(d.payload().block()->allocatorId) == alloc.get());
+}
+
+// the clones of an aborted transaction are freed before it ends, so the arena rewinds
+// and the next transaction reuses their memory
+void arenaRewind()
+{
+    Root<State> root(Node<State>{}, AllocatorRef::make<TransactionArena>());
+    auto abortedClone = [&] {
+        root.beginTransaction();
+        auto ret = root.transactionData();
+        ret->a = 1;
+        root.endTransaction(false);
+        return ret;
+    };
+
+    auto first = abortedClone();
+    CHECK(abortedClone() == first);
+
+    // with a reclaimer dead payloads are usually freed on its thread
+    Reclaimer reclaimer;
+    CHECK(abortedClone() == first);
+    CHECK(abortedClone() == first);
+
+    root.beginTransaction();
+    root.transactionData()->a = 2;
+    root.endTransaction();
+    CHECK(root.detach()->a == 2);
+}
+
+void singleReclaimer()
+{
+    {
+        Reclaimer reclaimer;
+        bool thrown = false;
+        try
+        {
+            Reclaimer second;
+        }
+        catch (std::logic_error&)
+        {
+            thrown = true;
+        }
+        CHECK(thrown);
+
+        // many releasers at once
+        Root<State> root(Node<State>{});
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i)
+        {
+            threads.emplace_back([&] {
+                for (int j = 0; j < 1000; ++j)
+                {
+                    root.beginTransaction();
+                    ++root.transactionData()->a;
+                    root.endTransaction();
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        CHECK(root.detach()->a == 4000);
+    }
+
+    // the previous one is gone
+    Reclaimer reclaimer;
+}
+
+int main()
+{
+    transactionsEndingOutOfOrder();
+    payloadsFromTheRootAllocator();
+    arenaRewind();
+    singleReclaimer();
+    return 0;
+}
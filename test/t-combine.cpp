@@ -0,0 +1,132 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include "Session.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace kuzco;
+
+struct State
+{
+    int n = 0;
+    std::vector<int> log;
+};
+
+void single()
+{
+    StateRoot<State> root(Node<State>{});
+    root.combinedTransaction([](State& s) { s.n = 1; });
+    root.combinedTransaction([](State& s) { s.n = 2; });
+    CHECK(root.detach()->n == 2);
+    CHECK(root.version() == 2);
+}
+
+// mutations queued while the transaction lock is held are applied in one transaction
+void batching()
+{
+    StateRoot<State> root(Node<State>{});
+
+    std::vector<std::thread> threads;
+    {
+        auto t = root.transaction();
+        t.cancel();
+        for (int i = 0; i < 8; ++i)
+        {
+            threads.emplace_back([&] {
+                root.combinedTransaction([](State& s) { ++s.n; });
+            });
+        }
+        // there's nothing to wait for: they queue and block
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    for (auto& t : threads) t.join();
+
+    CHECK(root.detach()->n == 8);
+    CHECK(root.version() == 1); // one publish
+}
+
+void throwingMutation()
+{
+    StateRoot<State> root(Node<State>{});
+
+    std::atomic_int caught = 0;
+    std::vector<std::thread> threads;
+    {
+        auto t = root.transaction();
+        t.cancel();
+        for (int i = 0; i < 8; ++i)
+        {
+            threads.emplace_back([&, i] {
+                try
+                {
+                    root.combinedTransaction([i](State& s) {
+                        s.log.push_back(i);
+                        if (i == 3) throw std::runtime_error("three");
+                        ++s.n;
+                    });
+                }
+                catch (std::runtime_error&)
+                {
+                    ++caught;
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    for (auto& t : threads) t.join();
+
+    CHECK(caught == 1);
+    auto s = root.detach();
+    CHECK(s->n == 7);
+    CHECK(s->log.size() == 7); // the partial change of the throwing one was rolled back
+    for (auto i : s->log) CHECK(i != 3);
+}
+
+// the mutations of each thread are applied in the order it made them
+void ordering()
+{
+    StateRoot<State> root(Node<State>{});
+
+    const int numThreads = 4, perThread = 500;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < perThread; ++i)
+            {
+                root.combinedTransaction([=](State& s) { s.log.push_back(t * perThread + i); });
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    auto s = root.detach();
+    CHECK(int(s->log.size()) == numThreads * perThread);
+    std::vector<int> last(numThreads, -1);
+    for (auto v : s->log)
+    {
+        auto t = v / perThread;
+        CHECK(v % perThread == last[t] + 1);
+        last[t] = v % perThread;
+    }
+}
+
+int main()
+{
+    single();
+    batching();
+    throwingMutation();
+    ordering();
+    return 0;
+}
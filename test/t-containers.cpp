@@ -0,0 +1,268 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include <kuzco/Map.hpp>
+#include <kuzco/OrderedMap.hpp>
+#include <kuzco/Vector.hpp>
+#include <kuzco/Node.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace kuzco;
+
+// edits through node values of a copy of a container must not change the original
+// (the node handles in the cloned container nodes are shared with the original ones)
+
+void orderedMapNodeValues()
+{
+    using M = OrderedMap<int, Node<std::string>>;
+    auto check = [](const M& m, const char* v) {
+        for (auto e : m) CHECK(*e.second == v);
+    };
+    auto touch = [](M& m, const std::vector<int>& keys) {
+        for (auto k : keys) m.update(k, [](Node<std::string>& n) { *n = "changed"; });
+    };
+
+    M orig;
+    for (int i = 1; i <= 5; ++i) orig.set(i * 10, Node<std::string>("orig"));
+
+    // shifting in leaves on insert
+    {
+        M copy = orig;
+        copy.set(5, Node<std::string>("new"));
+        touch(copy, {10, 20, 30, 40, 50});
+        check(orig, "orig");
+    }
+
+    // shifting on erase
+    {
+        M copy = orig;
+        copy.erase(10);
+        touch(copy, {20, 30, 40, 50});
+        check(orig, "orig");
+    }
+
+    // splits and merges
+    M big;
+    for (int i = 0; i < 1000; ++i) big.set(i * 2, Node<std::string>("orig"));
+    {
+        M copy = big;
+        for (int i = 0; i < 1000; ++i) copy.set(i * 2 + 1, Node<std::string>("new"));
+        for (int i = 0; i < 1000; i += 3) copy.erase(i * 2);
+        for (auto e : copy) copy.update(e.first, [](Node<std::string>& n) { *n = "changed"; });
+        check(big, "orig");
+    }
+
+    // transients
+    {
+        auto t = big.transient();
+        t.insert(-1, Node<std::string>("new"));
+        for (int i = 0; i < 1000; i += 2) t.erase(i * 2);
+        for (int i = 1; i < 1000; i += 2) t.update(i * 2, [](Node<std::string>& n) { *n = "changed"; });
+        auto copy = t.persistent();
+        CHECK(copy.size() == 501);
+        check(big, "orig");
+    }
+
+    // bulk loads which move elements between leaves
+    {
+        std::vector<std::pair<int, Node<std::string>>> v;
+        for (int i = 0; i < 40; ++i) v.emplace_back(i, Node<std::string>("orig"));
+        M loaded(v.begin(), v.end());
+        M copy = loaded;
+        copy.set(-1, Node<std::string>("new"));
+        for (int i = 0; i < 40; ++i) copy.update(i, [](Node<std::string>& n) { *n = "changed"; });
+        check(loaded, "orig");
+        for (auto& e : v) CHECK(*e.second == "orig");
+    }
+}
+
+void mapNodeValues()
+{
+    using M = Map<int, Node<std::string>>;
+    auto check = [](const M& m, const char* v) {
+        for (auto& e : m) CHECK(*e.second == v);
+    };
+    auto touchAll = [](M& m) {
+        std::vector<int> keys;
+        for (auto& e : m) keys.push_back(e.first);
+        for (auto k : keys) m.update(k, [](Node<std::string>& n) { *n = "changed"; });
+    };
+
+    M orig;
+    for (int i = 0; i < 5; ++i) orig.set(i, Node<std::string>("orig"));
+
+    // entries shifted in the vectors of trie nodes on erase and insert
+    {
+        M copy = orig;
+        copy.erase(2);
+        touchAll(copy);
+        check(orig, "orig");
+    }
+    {
+        M copy = orig;
+        copy.set(7, Node<std::string>("new"));
+        touchAll(copy);
+        check(orig, "orig");
+    }
+
+    // pushing entries down and merging them back up
+    M big;
+    for (int i = 0; i < 3000; ++i) big.set(i, Node<std::string>("orig"));
+    {
+        M copy = big;
+        for (int i = 3000; i < 6000; ++i) copy.set(i, Node<std::string>("new"));
+        for (int i = 0; i < 6000; i += 3) copy.erase(i);
+        touchAll(copy);
+        check(big, "orig");
+    }
+    {
+        auto t = big.transient();
+        for (int i = 0; i < 3000; i += 2) t.erase(i);
+        auto copy = t.persistent();
+        touchAll(copy);
+        check(big, "orig");
+    }
+}
+
+// assigning a copy of a node of a snapshot must not make the target editable in place
+void nodeMoveAssignment()
+{
+    struct Inner
+    {
+        Node<std::string> name;
+    };
+    Node<Inner> snapshot(Inner{Node<std::string>("orig")});
+
+    Node<Inner> target;
+    target = Node<Inner>(snapshot);
+    *target->name = "changed";
+    CHECK(*snapshot->name == "orig");
+    CHECK(*target->name == "changed");
+}
+
+// counts live elements, to check what the containers release
+struct Counted
+{
+    static inline int live = 0;
+    Counted(int v = 0) : value(v) { ++live; }
+    Counted(const Counted& other) : value(other.value) { ++live; }
+    Counted& operator=(const Counted&) = default;
+    ~Counted() { --live; }
+    bool operator==(const Counted& other) const { return value == other.value; }
+    int value;
+};
+
+template <typename T>
+bool same(const Vector<T>& v, const std::deque<T>& d)
+{
+    if (v.size() != d.size()) return false;
+    for (size_t i = 0; i < d.size(); ++i)
+    {
+        if (!(v[i] == d[i])) return false;
+    }
+    return std::equal(v.begin(), v.end(), d.begin());
+}
+
+void vectorDrop()
+{
+    std::srand(42);
+    Vector<int> v;
+    std::deque<int> d;
+    int next = 0;
+    for (int step = 0; step < 20000; ++step)
+    {
+        const auto op = std::rand() % 16;
+        if (op < 9 || d.empty())
+        {
+            const auto n = std::rand() % 70;
+            for (int i = 0; i < n; ++i)
+            {
+                v.push_back(next);
+                d.push_back(next++);
+            }
+        }
+        else if (op < 12)
+        {
+            const auto n = size_t(std::rand()) % (d.size() + 1);
+            v.drop(n);
+            d.erase(d.begin(), d.begin() + std::min(n, d.size()));
+        }
+        else if (op < 13)
+        {
+            const auto n = size_t(std::rand()) % (d.size() + 1);
+            v.take(n);
+            d.resize(std::min(n, d.size()));
+        }
+        else if (op < 15)
+        {
+            const auto n = std::rand() % 40;
+            for (int i = 0; i < n && !d.empty(); ++i)
+            {
+                v.pop_back();
+                d.pop_back();
+            }
+        }
+        else
+        {
+            const auto i = size_t(std::rand()) % d.size();
+            v.set(i, -1);
+            d[i] = -1;
+        }
+        CHECK(same(v, d));
+    }
+
+    // snapshots keep their elements
+    Vector<int> a;
+    for (int i = 0; i < 5000; ++i) a.push_back(i);
+    auto b = a;
+    a.drop(3000);
+    a.push_back(5000);
+    CHECK(b.size() == 5000);
+    CHECK(b[0] == 0 && b[4999] == 4999);
+    CHECK(a.size() == 2001);
+    CHECK(a[0] == 3000 && a[2000] == 5000);
+    auto s = b.slice(1000, 4000);
+    CHECK(s.size() == 3000);
+    CHECK(s[0] == 1000 && s[2999] == 3999);
+}
+
+void vectorQueue()
+{
+    {
+        // used as a queue the vector doesn't keep what was dropped
+        Vector<Counted> q;
+        for (int i = 0; i < 100; ++i) q.push_back(i);
+        for (int i = 100; i < 200000; ++i)
+        {
+            q.push_back(i);
+            q.drop(1);
+            CHECK(Counted::live < 100 + 3 * 32);
+        }
+        CHECK(q.size() == 100);
+        CHECK(q.front().value == 199900);
+        CHECK(q.back().value == 199999);
+    }
+    CHECK(Counted::live == 0);
+}
+
+int main()
+{
+    orderedMapNodeValues();
+    mapNodeValues();
+    nodeMoveAssignment();
+    vectorDrop();
+    vectorQueue();
+    return 0;
+}
@@ -0,0 +1,181 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include "Session.hpp"
+
+#if !KUZCO_HAS_COROUTINES
+#error "this test must be compiled as C++20"
+#endif
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <vector>
+
+using namespace kuzco;
+
+// a coroutine which starts eagerly and is destroyed with its handle
+struct Task
+{
+    struct promise_type
+    {
+        Task get_return_object() { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Task() = default;
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        Task(std::move(other)).swap(*this);
+        return *this;
+    }
+    void swap(Task& other) noexcept { std::swap(handle, other.handle); }
+    ~Task() { if (handle) handle.destroy(); }
+
+    bool done() const { return handle.done(); }
+
+    std::coroutine_handle<promise_type> handle = nullptr;
+};
+
+struct State
+{
+    int n = 0;
+};
+
+// stack depth of the coroutines of a chain
+uintptr_t minFrame = UINTPTR_MAX, maxFrame = 0;
+
+[[gnu::noinline]] void recordFrame()
+{
+    auto f = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+    if (f < minFrame) minFrame = f;
+    if (f > maxFrame) maxFrame = f;
+}
+
+Task increment(StateRoot<State>& root)
+{
+    auto t = co_await root.asyncTransaction();
+    recordFrame();
+    t->n += 1;
+}
+
+void inlineChain()
+{
+    // each coroutine is resumed when the previous one ends its transaction
+    // with an empty resumer that's inline, but it must not nest
+    StateRoot<State> root(Node<State>{});
+    std::vector<Task> tasks;
+    {
+        auto t = root.transaction();
+        for (int i = 0; i < 10000; ++i) tasks.push_back(increment(root));
+        for (auto& task : tasks) CHECK(!task.done());
+    }
+    for (auto& task : tasks) CHECK(task.done());
+    CHECK(root.detach()->n == 10000);
+    CHECK(maxFrame - minFrame < 4096);
+}
+
+Task waitForVersion(StateRoot<State>& root, uint64_t v, uint64_t& result)
+{
+    result = co_await root.waitForVersionAsync(v);
+}
+
+Task waitUntil(StateRoot<State>& root, int n, int& result)
+{
+    auto s = co_await root.waitUntilAsync([n](const State& s) { return s.n >= n; });
+    result = s->n;
+}
+
+void waits()
+{
+    StateRoot<State> root(Node<State>{});
+    uint64_t version = 0;
+    int n = 0;
+    auto a = waitForVersion(root, 2, version);
+    auto b = waitUntil(root, 3, n);
+    auto c = waitForVersion(root, 5, version);
+    c = {}; // destroyed while waiting
+
+    for (int i = 0; i < 3; ++i)
+    {
+        auto t = root.transaction();
+        t->n += 1;
+        if (i == 1) CHECK(!a.done());
+    }
+    CHECK(a.done());
+    CHECK(b.done());
+    CHECK(version == 2);
+    CHECK(n == 3);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        auto t = root.transaction();
+        t->n += 1;
+    }
+}
+
+void destroyedWhileQueued()
+{
+    StateRoot<State> root(Node<State>{});
+
+    // destroyed while waiting for the lock
+    {
+        Task a, b, c;
+        {
+            auto t = root.transaction();
+            a = increment(root);
+            b = increment(root);
+            c = increment(root);
+            b = {};
+            t->n = 10;
+            c = {};
+        }
+        CHECK(a.done());
+    }
+    CHECK(root.detach()->n == 11);
+
+    // the lock was handed to a coroutine which was never resumed
+    std::vector<std::coroutine_handle<>> posted;
+    Resumer post = [&](std::coroutine_handle<> h) { posted.push_back(h); };
+    auto incrementPosted = [&]() -> Task {
+        auto t = co_await root.asyncTransaction(post);
+        t->n += 1;
+    };
+    {
+        std::optional<Task> a;
+        {
+            auto t = root.transaction();
+            a.emplace(incrementPosted());
+        }
+        CHECK(posted.size() == 1);
+        CHECK(!a->done());
+    }
+    posted.clear();
+
+    // the lock was passed on
+    {
+        auto t = root.transaction();
+        t->n += 1;
+    }
+    CHECK(root.detach()->n == 12);
+}
+
+int main()
+{
+    inlineChain();
+    waits();
+    destroyedWhileQueued();
+    return 0;
+}
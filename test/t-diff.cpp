@@ -0,0 +1,185 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include <kuzco/Root.hpp>
+#include <kuzco/Diff.hpp>
+
+#include <string>
+#include <tuple>
+#include <typeinfo>
+#include <utility>
+
+using namespace kuzco;
+
+struct Part
+{
+    Leaf<int> x = 0;
+    Node<std::string> s;
+};
+
+inline auto kuzcoFields(const Part*)
+{
+    return std::make_tuple(field("x", &Part::x), field("s", &Part::s));
+}
+
+// no fields, compared with operator==
+struct Point
+{
+    int x = 0;
+    int y = 0;
+    bool operator==(const Point& p) const { return x == p.x && y == p.y; }
+};
+
+// no fields and nothing to compare with: recorded whenever it's visited
+struct Opaque
+{
+    int v = 0;
+};
+
+struct State
+{
+    Node<Part> a;
+    Node<Part> b;
+    Node<Opaque> o;
+    OptNode<Part> opt;
+    Point p;
+    int n = 0;
+};
+
+inline auto kuzcoFields(const State*)
+{
+    return std::make_tuple(field("a", &State::a), field("b", &State::b), field("o", &State::o),
+        field("opt", &State::opt), field("p", &State::p), field("n", &State::n));
+}
+
+template <typename F>
+Diff<State> commit(Root<State>& root, F f)
+{
+    auto before = root.detach();
+    root.beginTransaction();
+    f(*root.transactionData());
+    root.endTransaction();
+    return Diff<State>(std::move(before), root.detach());
+}
+
+void fieldPaths()
+{
+    Root<State> root(Node<State>{});
+    auto d = commit(root, [](State& s) {
+        s.a->x = 5;
+        *s.a->s = "a";
+        s.n = 3;
+    });
+
+    auto& c = d.changes();
+    CHECK(c.size() == 3);
+    CHECK(c[0].path == "/a/x");
+    CHECK(*c[0].oldAs<int>() == 0);
+    CHECK(*c[0].newAs<int>() == 5);
+    CHECK(!c[0].newAs<std::string>()); // wrong type
+    CHECK(c[1].path == "/a/s");
+    CHECK(*c[1].newAs<std::string>() == "a");
+    CHECK(c[2].path == "/n");
+    CHECK(*c[2].oldAs<int>() == 0);
+    CHECK(*c[2].newAs<int>() == 3);
+
+    // the values live in the snapshots of the diff
+    CHECK(c[0].newData == d.newRoot()->a->x.get());
+}
+
+void wholeObjects()
+{
+    Root<State> root(Node<State>{});
+    auto d = commit(root, [](State& s) {
+        s.o->v = 1;
+        s.p.y = 2;
+    });
+
+    auto& c = d.changes();
+    CHECK(c.size() == 2);
+    CHECK(c[0].path == "/o");
+    CHECK(c[0].oldAs<Opaque>()->v == 0);
+    CHECK(c[0].newAs<Opaque>()->v == 1);
+    CHECK(c[1].path == "/p");
+    CHECK(c[1].newAs<Point>()->y == 2);
+
+    // equal values of comparable types aren't changes
+    d = commit(root, [](State& s) {
+        s.p = Point{0, 2};
+    });
+    CHECK(d.empty());
+}
+
+void optNodes()
+{
+    Root<State> root(Node<State>{});
+    auto d = commit(root, [](State& s) {
+        s.opt = Node<Part>{};
+    });
+    CHECK(d.changes().size() == 1);
+    auto& set = d.changes().front();
+    CHECK(set.path == "/opt");
+    CHECK(*set.type == typeid(Part));
+    CHECK(!set.oldData);
+    CHECK(set.newAs<Part>() == d.newRoot()->opt.get());
+
+    // non-null on both sides: by field
+    d = commit(root, [](State& s) {
+        s.opt->x = 1;
+    });
+    CHECK(d.changes().size() == 1);
+    CHECK(d.changes().front().path == "/opt/x");
+
+    d = commit(root, [](State& s) {
+        s.opt.reset();
+    });
+    CHECK(d.changes().size() == 1);
+    auto& reset = d.changes().front();
+    CHECK(reset.path == "/opt");
+    CHECK(*reset.oldAs<Part>()->x == 1);
+    CHECK(!reset.newData);
+}
+
+void sharedSubtrees()
+{
+    Root<State> root(Node<State>{});
+    commit(root, [](State& s) {
+        s.b->x = 1;
+        s.o->v = 1;
+    });
+
+    // b and o are the same payloads in both snapshots, so they're not visited
+    // (o would be recorded if it were)
+    auto d = commit(root, [](State& s) {
+        s.a->x = 2;
+    });
+    CHECK(d.changes().size() == 1);
+    CHECK(d.changes().front().path == "/a/x");
+    CHECK(d.oldRoot()->b.get() == d.newRoot()->b.get());
+    CHECK(d.oldRoot()->o.get() == d.newRoot()->o.get());
+
+    // the same snapshot
+    auto s = root.detach();
+    CHECK(Diff<State>(s, s).empty());
+
+    // a transaction which only reads doesn't clone anything
+    d = commit(root, [](State& s) {
+        CHECK(*std::as_const(s).a->x == 2);
+    });
+    CHECK(d.empty());
+}
+
+int main()
+{
+    fieldPaths();
+    wholeObjects();
+    optNodes();
+    sharedSubtrees();
+    return 0;
+}
@@ -0,0 +1,139 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include <kuzco/Root.hpp>
+#include <kuzco/Vector.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace kuzco;
+
+struct Inner
+{
+    Node<std::string> name;
+    Leaf<int> x;
+};
+
+struct State
+{
+    Node<Inner> a;
+    Node<Inner> b;
+};
+
+void parents()
+{
+    Root<State> root(Node<State>{});
+    root.setJournaling(true);
+    auto before = root.detach();
+
+    root.beginTransaction();
+    *root.transactionData()->b->name = "q";
+    root.transactionData()->a = Node<Inner>{};
+    root.endTransaction();
+
+    auto j = root.lastJournal();
+    auto after = root.detach();
+    CHECK(j && j->version() == root.version());
+    auto& e = j->entries();
+    CHECK(e.size() == 4);
+    CHECK(e[0].parent == -1 && e[0].oldData == before.get() && e[0].newData == after.get());
+    CHECK(e[1].parent == 0 && e[1].newData == after->b.qget());
+    CHECK(e[2].parent == 1 && e[2].newData == after->b->name.qget());
+    CHECK(e[3].parent == 0 && e[3].oldData == before->a.qget() && e[3].newData == after->a.qget());
+    CHECK((j->ancestors(2) == std::vector<int>{1, 0}));
+
+    // the same node replaced twice
+    root.beginTransaction();
+    root.transactionData()->a = Node<Inner>{};
+    root.transactionData()->a = Node<Inner>{};
+    root.endTransaction();
+    auto j2 = root.lastJournal();
+    CHECK(j2->entries().size() == 2);
+    CHECK(j2->entries()[1].newData == root.detach()->a.qget());
+}
+
+void publishedJournalIsNotCurrent()
+{
+    Root<State> root(Node<State>{});
+    root.setJournaling(true);
+    root.beginTransaction();
+    root.transactionData()->a->x = 1;
+    root.endTransaction();
+
+    auto j = root.lastJournal();
+    const auto size = j->entries().size();
+    CHECK(size == 2);
+    CHECK(Journal::current() == nullptr);
+
+    // edits outside of transactions must not be recorded in the published journal
+    Node<Inner> local;
+    Node<Inner> copy = local;
+    copy->x = 5;
+    CHECK(j->entries().size() == size);
+
+    // nor must edits in transactions of roots without journaling
+    Root<State> other(Node<State>{});
+    other.beginTransaction();
+    other.transactionData()->b->x = 3;
+    other.endTransaction();
+    CHECK(j->entries().size() == size);
+}
+
+void transactionsEndingOutOfOrder()
+{
+    Root<State> a(Node<State>{});
+    Root<State> b(Node<State>{});
+    a.setJournaling(true);
+    b.setJournaling(true);
+
+    a.beginTransaction();
+    a.transactionData()->a->x = 1;
+    b.beginTransaction();
+    a.endTransaction();
+    CHECK(Journal::current() != nullptr); // b's
+    b.transactionData()->a->x = 1;
+    b.endTransaction();
+    CHECK(Journal::current() == nullptr);
+
+    CHECK(a.lastJournal()->entries().size() == 2);
+    CHECK(b.lastJournal()->entries().size() == 2);
+}
+
+void manyNodes()
+{
+    struct Big
+    {
+        Vector<Node<Inner>> items;
+    };
+    Root<Big> root(Node<Big>{});
+    root.beginTransaction();
+    for (int i = 0; i < 50000; ++i) root.transactionData()->items.push_back(Node<Inner>{});
+    root.endTransaction();
+
+    root.setJournaling(true);
+    root.beginTransaction();
+    auto& items = root.transactionData()->items;
+    for (size_t i = 0; i < items.size(); ++i) items.update(i, [](Node<Inner>& n) { n->x = 1; });
+    root.endTransaction();
+
+    // the nodes live in vector leaves, not directly in a payload, so they have no parent
+    auto j = root.lastJournal();
+    CHECK(j->entries().size() == 50001);
+    for (size_t i = 1; i < j->entries().size(); ++i) CHECK(j->entries()[i].parent == -1);
+}
+
+int main()
+{
+    parents();
+    publishedJournalIsNotCurrent();
+    transactionsEndingOutOfOrder();
+    manyNodes();
+    return 0;
+}
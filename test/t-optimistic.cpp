@@ -0,0 +1,234 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include <kuzco/Root.hpp>
+
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace kuzco;
+
+struct Part
+{
+    Leaf<int> x = 0;
+    Node<std::string> s;
+};
+
+inline auto kuzcoFields(const Part*)
+{
+    return std::make_tuple(field("x", &Part::x), field("s", &Part::s));
+}
+
+struct State
+{
+    Node<Part> a;
+    Node<Part> b;
+    Node<Part> c;
+    Node<Part> d;
+    int n = 0;
+};
+
+inline auto kuzcoFields(const State*)
+{
+    return std::make_tuple(field("a", &State::a), field("b", &State::b),
+        field("c", &State::c), field("d", &State::d), field("n", &State::n));
+}
+
+// no fields: changes on both sides always conflict
+struct Opaque
+{
+    Node<Part> a;
+    Node<Part> b;
+};
+
+using OT = Root<State>::OptimisticTransaction;
+
+void disjointSubtrees()
+{
+    Root<State> root(Node<State>{});
+    OT t1(root), t2(root);
+    t1->a->x = 1;
+    *t2->b->s = "b";
+    CHECK(t1.commit());
+    CHECK(t2.commit());
+
+    auto s = root.detach();
+    CHECK(*s->a->x == 1);
+    CHECK(*s->b->s == "b");
+    CHECK(root.version() == 2);
+}
+
+void sameNodeDifferentFields()
+{
+    Root<State> root(Node<State>{});
+    OT t1(root), t2(root), t3(root);
+    t1->a->x = 1;
+    *t2->a->s = "a";
+    t3->n = 5;
+    CHECK(t1.commit());
+    CHECK(t2.commit());
+    CHECK(t3.commit());
+
+    auto s = root.detach();
+    CHECK(*s->a->x == 1);
+    CHECK(*s->a->s == "a");
+    CHECK(s->n == 5);
+}
+
+void conflicts()
+{
+    Root<State> root(Node<State>{});
+    {
+        OT t1(root), t2(root);
+        t1->a->x = 1;
+        t2->a->x = 2;
+        CHECK(t1.commit());
+        CHECK(!t2.commit());
+        CHECK(*root.detach()->a->x == 1);
+    }
+    {
+        // the same change on both sides is a conflict: the other one may have been lost
+        OT t1(root), t2(root);
+        t1->n = t1->n + 1;
+        t2->n = t2->n + 1;
+        t1->a->x = *t1->a->x + 1;
+        t2->b->x = *t2->b->x + 1;
+        CHECK(t1.commit());
+        CHECK(!t2.commit());
+        CHECK(root.detach()->n == 1);
+
+        OT t3(root), t4(root);
+        t3->a->x = *t3->a->x + 1;
+        t4->a->x = *t4->a->x + 1;
+        CHECK(t3.commit());
+        CHECK(!t4.commit());
+        CHECK(*root.detach()->a->x == 3);
+    }
+    {
+        // a change merged with a regular transaction is not
+        OT t(root);
+        t->c->x = 7;
+        root.beginTransaction();
+        root.transactionData()->d->x = 8;
+        root.endTransaction();
+        CHECK(t.commit());
+        auto s = root.detach();
+        CHECK(*s->c->x == 7);
+        CHECK(*s->d->x == 8);
+        CHECK(*s->a->x == 3);
+    }
+
+    Root<Opaque> opaque(Node<Opaque>{});
+    Root<Opaque>::OptimisticTransaction t1(opaque), t2(opaque);
+    t1->a->x = 1;
+    t2->b->x = 2;
+    CHECK(t1.commit());
+    CHECK(!t2.commit());
+}
+
+void writeAfterCommit()
+{
+    Root<State> root(Node<State>{});
+    OT t(root), other(root);
+    other->b->x = 5;
+    CHECK(other.commit());
+
+    t->a->x = 1;
+    CHECK(t.commit()); // merged
+    auto published = root.detach();
+    CHECK(*published->a->x == 1);
+    CHECK(*published->b->x == 5);
+
+    // the published root is not edited
+    t->a->x = 2;
+    t->n = 42;
+    CHECK(*published->a->x == 1);
+    CHECK(published->n == 0);
+    CHECK(root.detach() == published);
+
+    // the transaction continues from the published root
+    CHECK(t.commit());
+    auto s = root.detach();
+    CHECK(*s->a->x == 2);
+    CHECK(*s->b->x == 5);
+    CHECK(s->n == 42);
+    CHECK(root.version() == 3);
+}
+
+void compareAndPublish()
+{
+    Root<State> root(Node<State>{});
+    auto expected = root.detach();
+    Node<State> desired(*expected);
+    desired->n = 1;
+    CHECK(root.compareAndPublish(expected, std::move(desired)));
+    auto published = root.detach();
+    CHECK(published->n == 1);
+    CHECK(!std::as_const(desired).get()); // moved from
+
+    Node<State> stale(*expected);
+    stale->n = 2;
+    CHECK(!root.compareAndPublish(expected, std::move(stale)));
+    CHECK(stale->n == 2); // kept on failure
+    CHECK(root.detach()->n == 1);
+}
+
+void updateRetries()
+{
+    Root<State> root(Node<State>{});
+    int calls = 0;
+    root.update([&](State& s) {
+        // another update is published in the meantime
+        if (++calls == 1) root.update([](State& s) { s.n = s.n + 1; });
+        s.n = s.n + 1;
+    });
+    CHECK(calls == 2);
+    CHECK(root.detach()->n == 2);
+}
+
+void concurrentWriters()
+{
+    Root<State> root(Node<State>{});
+    constexpr int N = 1000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&, i] {
+            auto part = i == 0 ? &State::a : i == 1 ? &State::b : i == 2 ? &State::c : &State::d;
+            for (int j = 0; j < N; ++j)
+            {
+                root.update([&](State& s) {
+                    auto& p = s.*part;
+                    p->x = *p->x + 1;
+                });
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    auto s = root.detach();
+    CHECK(*s->a->x == N);
+    CHECK(*s->b->x == N);
+    CHECK(*s->c->x == N);
+    CHECK(*s->d->x == N);
+}
+
+int main()
+{
+    disjointSubtrees();
+    sameNodeDifferentFields();
+    conflicts();
+    writeAfterCommit();
+    compareAndPublish();
+    updateRetries();
+    concurrentWriters();
+    return 0;
+}
@@ -0,0 +1,93 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include "Session.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace kuzco;
+
+struct State
+{
+    Leaf<int> a = 0;
+    Leaf<int> b = 0;
+};
+
+void subscriberPublishing()
+{
+    StateRoot<State> root(Node<State>{});
+    int onA = 0, onB = 0, lastB = 0;
+    root.subscribe([](const State& s) { return s.a; }, [&](const Detached<State>& d) {
+        ++onA;
+        // commits to the root which is notifying
+        auto t = root.transaction();
+        t->b = *d->a * 10;
+    });
+    root.subscribe([](const State& s) { return s.b; }, [&](const Detached<State>& d) {
+        ++onB;
+        lastB = *d->b;
+    });
+
+    {
+        auto t = root.transaction();
+        t->a = 1;
+    }
+    CHECK(onA == 1);
+    CHECK(onB == 1);
+    CHECK(lastB == 10);
+    CHECK(*root.detach()->b == 10);
+
+    {
+        auto t = root.transaction();
+        t->a = 2;
+    }
+    CHECK(onA == 2);
+    CHECK(onB == 2);
+    CHECK(lastB == 20);
+}
+
+void concurrentPublishers()
+{
+    StateRoot<State> root(Node<State>{});
+    std::atomic_int inside = 0;
+    int last = 0;
+    bool ok = true;
+    root.subscribe([&](const Detached<State>& d) {
+        if (inside.fetch_add(1) != 0) ok = false; // never called concurrently
+        if (*d->a <= last) ok = false; // never goes backwards
+        last = *d->a;
+        std::this_thread::yield();
+        inside.fetch_sub(1);
+    });
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&] {
+            for (int j = 0; j < 500; ++j)
+            {
+                auto t = root.transaction();
+                t->a = *t->a + 1;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    CHECK(ok);
+    CHECK(last == 2000); // the newest state is always delivered
+}
+
+int main()
+{
+    subscriberPublishing();
+    concurrentPublishers();
+    return 0;
+}
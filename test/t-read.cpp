@@ -0,0 +1,138 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include <kuzco/Root.hpp>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace kuzco;
+
+std::atomic_int numStates = 0;
+
+struct State
+{
+    State() { ++numStates; }
+    State(const State& other) : a(other.a), b(other.b) { ++numStates; }
+    ~State() { --numStates; }
+    int a = 0;
+    int b = 0;
+};
+
+void commit(Root<State>& root, int a)
+{
+    root.beginTransaction();
+    root.transactionData()->a = a;
+    root.transactionData()->b = a;
+    root.endTransaction();
+}
+
+void replacedRootsAreReleased()
+{
+    Root<State> root(Node<State>{});
+    CHECK(numStates == 1);
+    commit(root, 1);
+    CHECK(numStates == 1);
+    CHECK(root.read([](const State& s) { return s.a; }) == 1);
+
+    root.enableEpochReads();
+    commit(root, 2);
+    CHECK(numStates == 1); // no readers
+    CHECK(root.read([](const State& s) { return s.a; }) == 2);
+}
+
+void releaseAfterReaders()
+{
+    Root<State> root(Node<State>{});
+    root.enableEpochReads();
+
+    std::atomic_int stage = 0;
+    std::thread reader([&] {
+        root.read([&](const State& s) {
+            stage = 1;
+            while (stage != 2) std::this_thread::yield();
+            CHECK(s.a == 0);
+        });
+        stage = 3;
+        while (stage != 4) std::this_thread::yield();
+    });
+
+    while (stage != 1) std::this_thread::yield();
+    commit(root, 1);
+    CHECK(numStates == 2); // the reader may be using the old one
+
+    stage = 2;
+    while (stage != 3) std::this_thread::yield();
+    CHECK(numStates == 2); // readers don't release
+
+    root.releaseRetired();
+    CHECK(numStates == 1);
+
+    stage = 4;
+    reader.join();
+}
+
+void manyRoots()
+{
+    auto a = std::make_unique<Root<State>>(Node<State>{});
+    Root<State> b(Node<State>{});
+    a->enableEpochReads();
+    b.enableEpochReads();
+    std::unique_ptr<Root<State>> c;
+
+    std::atomic_int stage = 0;
+    std::atomic_int done = 0;
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&] {
+            while (stage == 0)
+            {
+                a->read([](const State& s) { CHECK(s.a == s.b); });
+                b.read([](const State& s) { CHECK(s.a == s.b); });
+            }
+            ++done;
+
+            // a is destroyed while the threads which have slots in it are alive
+            while (stage != 2) std::this_thread::yield();
+            b.read([](const State& s) { CHECK(s.a == s.b); });
+            c->read([](const State& s) { CHECK(s.a == s.b); });
+        });
+    }
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        commit(*a, i);
+        commit(b, i);
+    }
+    stage = 1;
+    while (done != 4) std::this_thread::yield();
+
+    a.reset();
+    c = std::make_unique<Root<State>>(Node<State>{});
+    c->enableEpochReads();
+    stage = 2;
+    for (auto& t : readers) t.join();
+
+    CHECK(b.read([](const State& s) { return s.a; }) == 1999);
+    b.releaseRetired(); // readers may have held back the root replaced by the last commit
+    c.reset();
+    CHECK(numStates == 1);
+}
+
+int main()
+{
+    replacedRootsAreReleased();
+    releaseAfterReaders();
+    manyRoots();
+    CHECK(numStates == 0);
+    return 0;
+}
@@ -0,0 +1,92 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include <kuzco/Root.hpp>
+#include <kuzco/Selector.hpp>
+
+#include <numeric>
+#include <vector>
+
+using namespace kuzco;
+
+struct State
+{
+    Node<std::vector<int>> items;
+    Node<std::vector<int>> other;
+};
+
+void recomputedOnChange()
+{
+    Root<State> root(Node<State>{});
+    int calls = 0;
+    auto sum = select<std::vector<int>>([&](const std::vector<int>& v) {
+        ++calls;
+        return std::accumulate(v.begin(), v.end(), 0);
+    });
+
+    root.beginTransaction();
+    *root.transactionData()->items = {1, 2, 3};
+    root.endTransaction();
+
+    auto s1 = root.detach();
+    CHECK(*sum(s1->items.detach()) == 6);
+    CHECK(*sum(s1->items.payload()) == 6);
+    CHECK(calls == 1);
+
+    // the items are edited in place in the transaction (the node is unique after the first edit)
+    // but the published state has a new payload for them
+    root.beginTransaction();
+    root.transactionData()->items->push_back(10);
+    root.transactionData()->items->push_back(100);
+    root.endTransaction();
+
+    auto s2 = root.detach();
+    CHECK(*sum(s2->items.detach()) == 116);
+    CHECK(calls == 2);
+
+    // unchanged subtree: same payload
+    root.beginTransaction();
+    *root.transactionData()->other = {5};
+    root.endTransaction();
+    CHECK(*sum(root.detach()->items.detach()) == 116);
+    CHECK(calls == 2);
+
+    // the old snapshot is still valid
+    CHECK(*sum(s1->items.detach()) == 6);
+    CHECK(calls == 3);
+}
+
+void composed()
+{
+    Root<State> root(Node<State>{});
+    root.beginTransaction();
+    *root.transactionData()->items = {1, 2, 3, 6};
+    root.endTransaction();
+
+    auto sum = select<std::vector<int>>([](const std::vector<int>& v) { return std::accumulate(v.begin(), v.end(), 0); });
+    auto count = select<std::vector<int>>([](const std::vector<int>& v) { return int(v.size()); });
+    int calls = 0;
+    auto avg = select<int, int>([&](int s, int c) {
+        ++calls;
+        return c ? double(s) / c : 0.0;
+    });
+    auto avgOf = compose(avg, sum, count);
+
+    auto s = root.detach();
+    CHECK(*avgOf(s->items.detach(), s->items.detach()) == 3.0);
+    CHECK(*avgOf(s->items.detach(), s->items.detach()) == 3.0);
+    CHECK(calls == 1);
+}
+
+int main()
+{
+    recomputedOnChange();
+    composed();
+    return 0;
+}
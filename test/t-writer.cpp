@@ -0,0 +1,127 @@
+// kuzco
+// Copyright (c) 2020-2021 Borislav Stanimirov
+//
+// Distributed under the MIT Software License
+// See accompanying file LICENSE.txt or copy at
+// https://opensource.org/licenses/MIT
+//
+#include "check.hpp"
+
+#include <kuzco/WriterThread.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace kuzco;
+
+struct State
+{
+    int n = 0;
+    std::vector<int> log;
+};
+
+using Writer = WriterThread<State>;
+
+// mutations posted before the destructor are applied, even if their batch isn't due yet
+void drainOnDestruction()
+{
+    std::atomic_int done = 0;
+    int lastN = 0; // only accessed on the writer thread until it's joined
+    {
+        Writer::Cadence cadence;
+        cadence.maxBatch = 1000;
+        cadence.maxDelay = std::chrono::seconds(100);
+        Writer w(Node<State>{}, cadence);
+        for (int i = 0; i < 100; ++i)
+        {
+            w.post([](State& s) { ++s.n; }, [&](std::exception_ptr e) {
+                CHECK(!e);
+                ++done;
+                lastN = w.read([](const State& s) { return s.n; });
+            });
+        }
+    }
+    CHECK(done == 100);
+    CHECK(lastN == 100);
+}
+
+void exceptionIsolation()
+{
+    Writer::Cadence cadence;
+    cadence.maxBatch = 8;
+    cadence.maxDelay = std::chrono::seconds(100);
+    Writer w(Node<State>{}, cadence);
+
+    std::vector<std::future<void>> fs;
+    for (int i = 0; i < 8; ++i)
+    {
+        fs.push_back(w.post([i](State& s) {
+            s.log.push_back(i);
+            if (i == 3) throw std::runtime_error("three");
+            ++s.n;
+        }));
+    }
+
+    for (int i = 0; i < 8; ++i)
+    {
+        bool thrown = false;
+        try
+        {
+            fs[i].get();
+        }
+        catch (std::runtime_error&)
+        {
+            thrown = true;
+        }
+        CHECK(thrown == (i == 3));
+    }
+
+    auto s = w.detach();
+    CHECK(s->n == 7);
+    CHECK(s->log.size() == 7); // the partial change of the throwing one was rolled back
+    for (auto i : s->log) CHECK(i != 3);
+}
+
+// the mutations of each producer are applied in the order it posted them
+void multiProducerOrdering()
+{
+    Writer w(Node<State>{});
+
+    const int numThreads = 4, perThread = 1000;
+    std::vector<std::thread> threads;
+    std::vector<std::future<void>> lastPosted(numThreads);
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < perThread; ++i)
+            {
+                auto f = w.post([=](State& s) { s.log.push_back(t * perThread + i); });
+                if (i == perThread - 1) lastPosted[t] = std::move(f);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    for (auto& f : lastPosted) f.get();
+
+    auto s = w.detach();
+    CHECK(int(s->log.size()) == numThreads * perThread);
+    std::vector<int> last(numThreads, -1);
+    for (auto v : s->log)
+    {
+        auto t = v / perThread;
+        CHECK(v % perThread == last[t] + 1);
+        last[t] = v % perThread;
+    }
+}
+
+int main()
+{
+    drainOnDestruction();
+    exceptionIsolation();
+    multiProducerOrdering();
+    return 0;
+}